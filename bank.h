@@ -0,0 +1,115 @@
+// ============================================================================
+// Bank - Sound IDs
+// Sounds are addressed with 32-bit IDs that are interned from their names with
+// the FNV-1a hash. The hash is a constant expression, so the IDs of the names
+// written in the code are computed by the compiler and no strings are handled
+// when the sounds are looked up.
+//
+// The bank index is a minimal perfect hash (hash and displace) over the IDs of
+// the bank. The IDs are grouped into buckets and each bucket gets the smallest
+// displacement that places all of its IDs into free slots. A lookup reads the
+// displacement of the bucket and then the slot with the ID and the file index.
+//
+// Two sounds with the same ID (the same name twice or a hash collision) can't
+// be told apart, so the index rejects them. The displacement search is bounded
+// and the build throws should no displacement place a bucket within the bound.
+// ============================================================================
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "memory.h"
+
+const uint32_t SOUND_INDEX_MAX_DISPLACEMENT = 1 << 20;
+
+constexpr uint32_t soundId(const wchar_t* name)
+{
+  uint32_t hash = 2166136261u;
+  for (; *name; name++)
+    hash = (hash ^ static_cast<uint32_t>(*name)) * 16777619u;
+  return hash;
+}
+
+class SoundIndex
+{
+public:
+  // build the perfect hash where each ID maps to its index in the given array.
+  void build(const std::vector<uint32_t>& ids)
+  {
+    std::vector<uint32_t> sorted(ids);
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+      throw std::invalid_argument("duplicate sound ID");
+
+    auto count = static_cast<uint32_t>(ids.size());
+    slots.assign(count, { 0, SLOT_INVALID });
+    displacements.assign(std::max(1u, count), 0);
+
+    // group the IDs into buckets and place the largest buckets first.
+    std::vector<std::vector<uint32_t>> buckets(displacements.size());
+    for (auto i = 0u; i < count; i++)
+      buckets[mix(ids[i], 0) % buckets.size()].push_back(i);
+    std::vector<uint32_t> order(buckets.size());
+    for (auto i = 0u; i < order.size(); i++)
+      order[i] = i;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return buckets[a].size() > buckets[b].size();
+    });
+
+    // find a displacement that places the whole bucket into free slots.
+    std::vector<uint32_t> placed;
+    for (auto b : order) {
+      auto& bucket = buckets[b];
+      if (bucket.empty())
+        break;
+      for (auto displacement = 1u;; displacement++) {
+        if (displacement > SOUND_INDEX_MAX_DISPLACEMENT)
+          throw std::runtime_error("no displacement places the sound ID bucket");
+        placed.clear();
+        for (auto i : bucket) {
+          auto slot = mix(ids[i], displacement) % count;
+          if (slots[slot].file != SLOT_INVALID || std::find(placed.begin(), placed.end(), slot) != placed.end())
+            break;
+          placed.push_back(slot);
+        }
+        if (placed.size() < bucket.size())
+          continue;
+        for (auto i = 0u; i < bucket.size(); i++)
+          slots[placed[i]] = { ids[bucket[i]], bucket[i] };
+        displacements[b] = displacement;
+        break;
+      }
+    }
+  }
+
+  // returns the index of the sound or SLOT_INVALID if it's not in the index.
+  uint32_t find(uint32_t id) const
+  {
+    if (slots.empty())
+      return SLOT_INVALID;
+    auto displacement = displacements[mix(id, 0) % displacements.size()];
+    auto& slot = slots[mix(id, displacement) % slots.size()];
+    return slot.id == id ? slot.file : SLOT_INVALID;
+  }
+
+private:
+  struct Slot
+  {
+    uint32_t id;
+    uint32_t file;
+  };
+
+  static uint32_t mix(uint32_t id, uint32_t displacement)
+  {
+    auto x = id ^ (displacement * 0x9E3779B9u);
+    x = (x ^ (x >> 16)) * 0x85EBCA6Bu;
+    x = (x ^ (x >> 13)) * 0xC2B2AE35u;
+    return x ^ (x >> 16);
+  }
+
+  std::vector<uint32_t> displacements;
+  std::vector<Slot>     slots;
+};
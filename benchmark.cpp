@@ -0,0 +1,572 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dsp.h"
+#include "memory.h"
+#include "mixer.h"
+#include "trace.h"
+
+// ============================================================================
+// Benchmark - Noise
+// Benchmarks are fed with a deterministic pseudo-random noise, so that the DSP
+// blocks are kept busy and the results are comparable between the runs. The
+// tests seed the channels differently to tell them apart in the output.
+// ============================================================================
+void fillNoise(float* samples, size_t count, unsigned int seed)
+{
+  for (auto i = size_t(0); i < count; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    samples[i] = (seed >> 8) * (2.f / 16777216.f) - 1.f;
+  }
+}
+
+PlanarBuffer noise(unsigned int channels, unsigned int frames, unsigned int seed)
+{
+  PlanarBuffer planes(channels, frames);
+  for (auto c = 0u; c < channels; c++)
+    fillNoise(planes.channel(c), frames, seed + c);
+  return planes;
+}
+
+// ============================================================================
+// Benchmark - DSP Block
+// Measures the average cost of processing a single 10ms block with the given
+// DSP block. The block is fed with noise to keep the dynamics processing busy.
+// ============================================================================
+void benchmarkBlock(const char* name, DspBlock& block, unsigned int channels)
+{
+  const auto rate = 48000u;
+  const auto frames = rate / 100;
+  const auto iterations = 10000;
+
+  PlanarBuffer input(channels, frames);
+  for (auto c = 0u; c < channels; c++)
+    fillNoise(input.channel(c), frames);
+
+  block.prepare(channels, rate, frames);
+  PlanarBuffer samples(channels, frames);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (auto i = 0; i < iterations; i++) {
+    for (auto c = 0u; c < channels; c++)
+      std::copy(input.channel(c), input.channel(c) + frames, samples.channel(c));
+    block.process(samples.data(), frames);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+
+  auto ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  std::cout << name << " (" << channels << " channels): " << ns << " ns/block, "
+            << ns / 1e5 << "% of the 10ms quantum" << std::endl;
+}
+
+// ============================================================================
+// Benchmark - Trace
+// Measures the average cost of recording a single scoped trace event and the
+// cost of a single timestamp counter read, as an event takes two of them.
+// ============================================================================
+void benchmarkTrace()
+{
+  const auto iterations = TRACE_MAX_EVENTS / 2;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (auto i = 0u; i < iterations; i++)
+    TraceScope trace("benchmark");
+  auto end = std::chrono::high_resolution_clock::now();
+
+  auto readStart = std::chrono::high_resolution_clock::now();
+  for (auto i = 0u; i < iterations; i++)
+    traceTimestamp();
+  auto readEnd = std::chrono::high_resolution_clock::now();
+
+  auto ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  auto read = std::chrono::duration<double, std::nano>(readEnd - readStart).count() / iterations;
+  std::cout << "trace: " << ns << " ns/event, " << read << " ns/timestamp" << std::endl;
+}
+
+// ============================================================================
+// Benchmark - Mixer Graph
+// Most of the mixer benchmarks render the same graph of four groups of four
+// submix buses, each carrying four stereo voices, for a number of quanta. The
+// voices are restarted whenever they end, so the graph stays busy throughout.
+// ============================================================================
+
+// build the benchmark graph where shardOf(g) gives the mixer of the group g,
+// optionally with a compressor and a limiter on each of the submix buses. the
+// group and submix buses are appended to buses when given.
+template <typename ShardOf>
+std::vector<MixVoice*> buildGraph(ShardOf shardOf, const std::shared_ptr<const PlanarBuffer>& samples,
+                                  bool dynamics, std::vector<MixBus*>* buses = nullptr)
+{
+  std::vector<MixVoice*> voices;
+  for (auto g = 0u; g < 4; g++) {
+    Mixer& mixer = shardOf(g);
+    auto group = mixer.createSubmix(2, nullptr);
+    if (buses) buses->push_back(group);
+    for (auto b = 0; b < 4; b++) {
+      auto bus = mixer.createSubmix(2, group);
+      if (buses) buses->push_back(bus);
+      if (dynamics) {
+        mixer.addEffect(bus, std::make_unique<Dynamics>(MASTER_COMPRESSOR));
+        mixer.addEffect(bus, std::make_unique<Dynamics>(MASTER_LIMITER));
+      }
+      for (auto v = 0; v < 4; v++)
+        voices.push_back(mixer.createVoice(samples, bus));
+    }
+  }
+  return voices;
+}
+
+// call render(i) for each of the iterations, restarting the voices which have
+// ended before each quantum, and return the average time of a quantum in ns.
+template <typename Render>
+double timeRendering(const std::vector<MixVoice*>& voices, unsigned int iterations, Render render)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  for (auto i = 0u; i < iterations; i++) {
+    for (auto voice : voices) {
+      if (!voice->playing) {
+        voice->position = 0;
+        voice->playing = true;
+      }
+    }
+    render(i);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+// ============================================================================
+// Benchmark - Mixer
+// Measures the average cost of rendering a 10ms quantum of a graph with four
+// groups of four submix buses, each carrying a compressor and a limiter and
+// four stereo voices. The graph is rendered with a single worker and with all
+// hardware threads, and the utilisation of each of the workers is reported.
+// ============================================================================
+void benchmarkMixer(unsigned int workers)
+{
+  const auto rate = 48000u;
+  const auto frames = rate / 100;
+  const auto iterations = 1000u;
+  const auto samples = std::make_shared<const PlanarBuffer>(noise(2, rate));
+
+  Mixer mixer(2, rate, frames, workers);
+  auto voices = buildGraph([&](unsigned int) -> Mixer& { return mixer; }, samples, true);
+
+  std::vector<float> output(frames * 2);
+  mixer.tasks().resetStatistics();
+  auto ns = timeRendering(voices, iterations, [&](unsigned int) { mixer.render(output.data(), frames); });
+  std::cout << "mixer (" << workers << " workers): " << ns << " ns/quantum, "
+            << mixer.overruns() << " overruns, utilisation";
+  for (auto w = 0u; w < mixer.tasks().workerCount(); w++)
+    std::cout << " " << int(mixer.tasks().utilisation(w) * 100.0) << "%";
+  std::cout << std::endl;
+}
+
+// ============================================================================
+// Benchmark - Sharded Mixer
+// Renders the same graph as the mixer benchmark, but with the bus groups dealt
+// across independent mixer shards whose master buses are merged at the end.
+// ============================================================================
+void benchmarkShardedMixer(unsigned int shardCount)
+{
+  const auto rate = 48000u;
+  const auto frames = rate / 100;
+  const auto iterations = 1000u;
+  const auto samples = std::make_shared<const PlanarBuffer>(noise(2, rate));
+
+  // build the benchmark graph with each bus group on a shard of its own.
+  ShardedMixer mixer(2, rate, frames, shardCount);
+  auto voices = buildGraph([&](unsigned int g) -> Mixer& { return mixer.shard(g); }, samples, true);
+
+  std::vector<float> output(frames * 2);
+  mixer.tasks().resetStatistics();
+  auto ns = timeRendering(voices, iterations, [&](unsigned int) { mixer.render(output.data(), frames); });
+  std::cout << "sharded mixer (" << shardCount << " shards): " << ns << " ns/quantum, "
+            << mixer.overruns() << " overruns, utilisation";
+  for (auto w = 0u; w < mixer.tasks().workerCount(); w++)
+    std::cout << " " << int(mixer.tasks().utilisation(w) * 100.0) << "%";
+  std::cout << std::endl;
+}
+
+// ============================================================================
+// Benchmark - Sample Ring
+// Streams 10 ms blocks through a sample ring from a producer thread into the
+// consumer thread. The throughput is measured over the whole transfer and the
+// latency from the commit of each block until the consumer gets to read it.
+// ============================================================================
+void benchmarkSampleRing()
+{
+  const auto blocks = 100000u;
+  const auto blockSize = size_t(480 * 2 * sizeof(float));
+  SampleRing ring(blockSize, 16);
+
+  auto startTicks = traceTimestamp();
+  auto start = std::chrono::high_resolution_clock::now();
+  std::thread producer([&] {
+    for (auto i = 0u; i < blocks; i++) {
+      uint8_t* block = nullptr;
+      while (!(block = ring.acquire()))
+        std::this_thread::yield();
+      auto timestamp = traceTimestamp();
+      std::memcpy(block, &timestamp, sizeof(timestamp));
+      ring.commit(blockSize);
+    }
+  });
+
+  std::vector<int64_t> latencies;
+  latencies.reserve(blocks);
+  for (auto i = 0u; i < blocks; i++) {
+    while (ring.readable() == 0)
+      std::this_thread::yield();
+    int64_t timestamp = 0;
+    std::memcpy(&timestamp, ring.peek().data, sizeof(timestamp));
+    latencies.push_back(traceTimestamp() - timestamp);
+    ring.release();
+  }
+  producer.join();
+  auto end = std::chrono::high_resolution_clock::now();
+  auto endTicks = traceTimestamp();
+
+  // convert the timestamp ticks into nanoseconds.
+  auto seconds = std::chrono::duration<double>(end - start).count();
+  auto ticksPerNs = (endTicks - startTicks) / (seconds * 1e9);
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << "sample ring: " << blocks * blockSize / seconds / (1 << 20) << " MB/s, latency "
+            << latencies[blocks / 2] / ticksPerNs << " ns median, "
+            << latencies[blocks * 99 / 100] / ticksPerNs << " ns p99" << std::endl;
+}
+
+// ============================================================================
+// Benchmark - Convolution Reverb
+// Measures the stereo convolution reverb for a few impulse response lengths and
+// partition sizes, where the partition size is also the added latency.
+// ============================================================================
+void benchmarkConvolution()
+{
+  const auto rate = 48000u;
+  for (auto seconds : { 0.5f, 1.f, 2.f, 4.f }) {
+    auto frames = static_cast<unsigned int>(seconds * rate);
+    for (auto partition : { 256u, 1024u }) {
+      ConvolutionReverb reverb(noise(2, frames), rate, 0, { partition, 1.f, 0.f });
+      auto name = "convolution " + std::to_string(seconds).substr(0, 3) + "s/" + std::to_string(partition);
+      benchmarkBlock(name.c_str(), reverb, 2);
+    }
+  }
+}
+
+// ============================================================================
+// Benchmark - Reverb Zones
+// Renders a mixer graph where each reverb zone is a submix bus with a feedback
+// delay network reverb, fed by a couple of voices.
+// ============================================================================
+void benchmarkReverbZones(unsigned int zones)
+{
+  const auto rate = 48000u;
+  const auto frames = rate / 100;
+  const auto iterations = 1000u;
+  const auto samples = std::make_shared<const PlanarBuffer>(noise(2, rate));
+
+  Mixer mixer(2, rate, frames, 1);
+  std::vector<MixVoice*> voices;
+  for (auto z = 0u; z < zones; z++) {
+    auto zone = mixer.createSubmix(2, nullptr);
+    mixer.addEffect(zone, std::make_unique<FdnReverb<8>>(FDN_ROOM));
+    for (auto v = 0; v < 2; v++)
+      voices.push_back(mixer.createVoice(samples, zone));
+  }
+
+  std::vector<float> output(frames * 2);
+  auto ns = timeRendering(voices, iterations, [&](unsigned int) { mixer.render(output.data(), frames); });
+  std::cout << "reverb zones (" << zones << " zones): " << ns << " ns/quantum, "
+            << ns / 1e5 << "% of the 10ms quantum" << std::endl;
+}
+
+// ============================================================================
+// Benchmark - Metering
+// Renders the mixer benchmark graph without effects on a single worker, once as
+// is and once with a meter on every bus, to get the cost of metering all buses.
+// ============================================================================
+double renderMeteringGraph(bool metered, unsigned int fftSize)
+{
+  const auto rate = 48000u;
+  const auto frames = rate / 100;
+  const auto iterations = 1000u;
+  const auto samples = std::make_shared<const PlanarBuffer>(noise(2, rate));
+
+  Mixer mixer(2, rate, frames, 1);
+  std::vector<MixBus*> buses = { mixer.master() };
+  auto voices = buildGraph([&](unsigned int) -> Mixer& { return mixer; }, samples, false, &buses);
+  if (metered)
+    for (auto bus : buses)
+      mixer.addEffect(bus, std::make_unique<Meter>(fftSize));
+
+  std::vector<float> output(frames * 2);
+  return timeRendering(voices, iterations, [&](unsigned int) { mixer.render(output.data(), frames); });
+}
+
+void benchmarkMetering(unsigned int fftSize)
+{
+  auto plain = renderMeteringGraph(false, fftSize);
+  auto metered = renderMeteringGraph(true, fftSize);
+  std::cout << "metering 21 buses (fft " << fftSize << "): " << metered - plain << " ns/quantum, "
+            << (metered - plain) / 1e5 << "% of the 10ms quantum" << std::endl;
+}
+
+// ============================================================================
+// Benchmark - Sidechain Ducking
+// Renders a graph where a dialogue bus ducks the music and the effects buses.
+// The dialogue is played for the first half of the run and muted for the rest,
+// so the gain reduction of the duck and the recovery after it are shown too.
+// ============================================================================
+void benchmarkDucking()
+{
+  const auto rate = 48000u;
+  const auto frames = rate / 100;
+  const auto iterations = 1000u;
+  const auto samples = std::make_shared<const PlanarBuffer>(noise(2, rate));
+
+  Mixer mixer(2, rate, frames, 1);
+  auto dialogue = mixer.createSubmix(2, nullptr);
+  auto music = mixer.createSubmix(2, nullptr);
+  auto effects = mixer.createSubmix(2, nullptr);
+  auto ducking = mixer.addDucking(dialogue, { music, effects }, DIALOGUE_DUCKING);
+  std::vector<MixVoice*> voices;
+  for (auto bus : { dialogue, music, effects })
+    for (auto v = 0; v < 4; v++)
+      voices.push_back(mixer.createVoice(samples, bus));
+
+  std::vector<float> output(frames * 2);
+  auto ducked = 0.f;
+  auto ns = timeRendering(voices, iterations, [&](unsigned int i) {
+    for (auto voice : voices)
+      if (voice->output == dialogue)
+        voice->volume = i < iterations / 2 ? 1.f : 0.f;
+    mixer.render(output.data(), frames);
+    if (i == iterations / 2 - 1)
+      ducked = ducking->sidechain.currentGain();
+  });
+  std::cout << "ducking: " << ns << " ns/quantum, ducked " << 20.f * std::log10(ducked)
+            << " dB, recovered " << 20.f * std::log10(ducking->sidechain.currentGain()) << " dB" << std::endl;
+}
+
+// ============================================================================
+// Benchmark - Sparse Scenes
+// Renders the mixer benchmark graph on a single worker where only the given
+// number of the voices is audible. The rest of the voices keep playing muted,
+// so their buses go silent and the effects are skipped after their tails.
+// ============================================================================
+void benchmarkSparseMixer(unsigned int audible)
+{
+  const auto rate = 48000u;
+  const auto frames = rate / 100;
+  const auto iterations = 1000u;
+  const auto samples = std::make_shared<const PlanarBuffer>(noise(2, rate));
+
+  Mixer mixer(2, rate, frames, 1);
+  auto voices = buildGraph([&](unsigned int) -> Mixer& { return mixer; }, samples, true);
+  for (auto v = size_t(audible); v < voices.size(); v++)
+    voices[v]->volume = 0.f;
+
+  std::vector<float> output(frames * 2);
+  auto ns = timeRendering(voices, iterations, [&](unsigned int) { mixer.render(output.data(), frames); });
+  std::cout << "sparse mixer (" << audible << "/" << voices.size() << " audible): "
+            << ns << " ns/quantum" << std::endl;
+}
+
+// ============================================================================
+// Benchmark - Mix Matrix
+// Mixes a block through the matrices of the common layouts, both with the dense
+// kernel of the layout and with the pattern dispatching mix matrix.
+// ============================================================================
+void benchmarkMixMatrix(const char* name, unsigned int inputs, unsigned int outputs, const std::vector<float>& gains)
+{
+  const auto frames = 480u;
+  const auto iterations = 20000;
+
+  PlanarBuffer input(inputs, frames), output(outputs, frames);
+  for (auto c = 0u; c < inputs; c++)
+    fillNoise(input.channel(c), frames);
+  MixMatrix matrix(inputs, outputs, gains);
+  auto dense = selectMixKernel(inputs, outputs);
+
+  auto time = [&](auto mix) {
+    output.clear(frames);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto i = 0; i < iterations; i++)
+      mix();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  };
+  auto denseNs = time([&] { dense(input.data(), inputs, output.data(), outputs, gains.data(), 0.5f, frames); });
+  auto matrixNs = time([&] { matrix.mix(input.data(), output.data(), 0.5f, frames); });
+
+  static const char* layouts[] = { "silent", "diagonal", "sparse", "dense" };
+  std::cout << "mix matrix " << name << " (" << layouts[matrix.layout()] << "): dense kernel "
+            << denseNs << " ns/block, matrix " << matrixNs << " ns/block" << std::endl;
+}
+
+void benchmarkMixMatrices()
+{
+  const auto h = 0.7071068f;
+  std::vector<float> pan71(8, 0.f);
+  pan71[0] = 0.8f;
+  pan71[2] = 0.6f;
+  std::vector<float> downmix51 = {
+    1.f, 0.f, h, 0.f, h, 0.f,
+    0.f, 1.f, h, 0.f, 0.f, h
+  };
+  std::vector<float> downmix71 = {
+    1.f, 0.f, h, 0.f, h, 0.f, h, 0.f,
+    0.f, 1.f, h, 0.f, 0.f, h, 0.f, h
+  };
+  std::vector<float> crossfeed = { 0.8f, 0.2f, 0.2f, 0.8f };
+  std::vector<float> full51(36, 1.f / 6.f);
+
+  benchmarkMixMatrix("mono -> stereo", 1, 2, defaultMatrix(1, 2));
+  benchmarkMixMatrix("stereo -> stereo", 2, 2, defaultMatrix(2, 2));
+  benchmarkMixMatrix("mono -> 7.1 panned", 1, 8, pan71);
+  benchmarkMixMatrix("stereo -> 7.1", 2, 8, defaultMatrix(2, 8));
+  benchmarkMixMatrix("7.1 -> 7.1", 8, 8, defaultMatrix(8, 8));
+  benchmarkMixMatrix("5.1 -> stereo downmix", 6, 2, downmix51);
+  benchmarkMixMatrix("7.1 -> stereo downmix", 8, 2, downmix71);
+  benchmarkMixMatrix("stereo crossfeed", 2, 2, crossfeed);
+  benchmarkMixMatrix("5.1 -> 5.1 full", 6, 6, full51);
+}
+
+// ============================================================================
+// Benchmark - Biquad Filter Bank
+// Filters a 10 ms quantum of the given number of voices with low-pass filters,
+// both with the filter bank and with one scalar biquad per voice.
+// ============================================================================
+void benchmarkBiquadBank(unsigned int count)
+{
+  const auto rate = 48000u;
+  const auto frames = rate / 100;
+  const auto iterations = 100;
+
+  PlanarBuffer signals(count, frames);
+  for (auto v = 0u; v < count; v++)
+    fillNoise(signals.channel(v), frames);
+
+  // batch update the coefficients as it would be done for each game frame.
+  BiquadBank bank(count);
+  std::vector<float> cutoff(count), q(count, 0.7071f);
+  for (auto v = 0u; v < count; v++)
+    cutoff[v] = 500.f + 15000.f * v / count;
+  auto start = std::chrono::high_resolution_clock::now();
+  bank.setLowpass(cutoff.data(), q.data(), float(rate));
+  auto end = std::chrono::high_resolution_clock::now();
+  auto updateNs = std::chrono::duration<double, std::nano>(end - start).count();
+
+  start = std::chrono::high_resolution_clock::now();
+  for (auto i = 0; i < iterations; i++)
+    bank.process(signals.data(), frames);
+  end = std::chrono::high_resolution_clock::now();
+  auto bankNs = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+
+  std::vector<Biquad> filters(count, Biquad{ 1.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f });
+  start = std::chrono::high_resolution_clock::now();
+  for (auto i = 0; i < iterations; i++)
+    for (auto v = 0u; v < count; v++)
+      filters[v].process(signals.channel(v), frames);
+  end = std::chrono::high_resolution_clock::now();
+  auto scalarNs = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+
+  std::cout << "biquad bank (" << count << " voices): " << bankNs << " ns/quantum ("
+            << bankNs / 1e5 << "% of the quantum), scalar " << scalarNs << " ns/quantum, update "
+            << updateNs << " ns" << std::endl;
+}
+
+// ============================================================================
+// Benchmark - Real-Time Pool
+// Measures the cost of creating and destroying small event records from the
+// real-time pool compared to the heap, with a few records alive at a time.
+// ============================================================================
+struct PoolRecord
+{
+  uint64_t timestamp;
+  uint32_t id;
+  float    value;
+};
+
+template <typename Create, typename Destroy>
+double benchmarkAllocations(Create create, Destroy destroy)
+{
+  const auto iterations = 100000;
+  const auto live = 16;
+  PoolRecord* records[live] = {};
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (auto i = 0; i < iterations; i++) {
+    auto& record = records[i % live];
+    if (record)
+      destroy(record);
+    record = create(i);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  for (auto record : records)
+    if (record)
+      destroy(record);
+  return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+void benchmarkPool()
+{
+  ObjectPool<PoolRecord> pool(64);
+  auto poolNs = benchmarkAllocations(
+    [&](int i) { return pool.create(PoolRecord{ uint64_t(i), uint32_t(i), 0.f }); },
+    [&](PoolRecord* record) { pool.destroy(record); });
+  auto heapNs = benchmarkAllocations(
+    [](int i) { return new PoolRecord{ uint64_t(i), uint32_t(i), 0.f }; },
+    [](PoolRecord* record) { delete record; });
+  std::cout << "pool: " << poolNs << " ns/record, heap: " << heapNs << " ns/record" << std::endl;
+}
+
+// ============================================================================
+// Benchmark - Run
+// Runs all the portable benchmarks. The sandbox runs these with the --bench
+// argument and the offline build with the same argument. The results are
+// printed into the standard output.
+// ============================================================================
+int runBenchmarks()
+{
+  startTracing();
+  benchmarkTrace();
+  benchmarkPool();
+  benchmarkSampleRing();
+
+  for (auto channels : { 2u, 8u }) {
+    Dynamics compressor(MASTER_COMPRESSOR);
+    Dynamics limiter(MASTER_LIMITER);
+    benchmarkBlock("compressor", compressor, channels);
+    benchmarkBlock("limiter", limiter, channels);
+  }
+  benchmarkConvolution();
+  {
+    FdnReverb<8> fdn8(FDN_ROOM);
+    FdnReverb<16> fdn16(FDN_ROOM);
+    benchmarkBlock("fdn reverb 8 lines", fdn8, 2);
+    benchmarkBlock("fdn reverb 16 lines", fdn16, 2);
+  }
+  benchmarkReverbZones(8);
+  benchmarkMetering(0);
+  benchmarkMetering(1024);
+  benchmarkDucking();
+  benchmarkBiquadBank(256);
+  benchmarkBiquadBank(4096);
+  benchmarkMixMatrices();
+  benchmarkMixer(1);
+  for (auto audible : { 64u, 16u, 4u, 0u })
+    benchmarkSparseMixer(audible);
+  benchmarkMixer(std::thread::hardware_concurrency());
+  benchmarkShardedMixer(1);
+  benchmarkShardedMixer(std::min(4u, std::max(1u, std::thread::hardware_concurrency())));
+  return 0;
+}
@@ -0,0 +1,19 @@
+// ============================================================================
+// XAudio2 Sandbox - Benchmarks
+// The benchmarks measure the portable parts of the sandbox, so the same runs
+// can be made both within the sandbox (--bench) and with the offline build.
+// ============================================================================
+#pragma once
+
+#include <cstddef>
+
+#include "dsp.h"
+
+// fill the samples with a deterministic pseudo-random noise.
+void fillNoise(float* samples, size_t count, unsigned int seed = 1);
+
+// create planes of the deterministic noise, seeded by the channel.
+PlanarBuffer noise(unsigned int channels, unsigned int frames, unsigned int seed = 1);
+
+// run all the portable benchmarks and print the results.
+int runBenchmarks();
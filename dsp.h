@@ -0,0 +1,1451 @@
+// ============================================================================
+// XAudio2 Sandbox - DSP
+// All our own signal processing is written as portable code without any
+// dependencies to XAudio2 or the other Windows APIs, so that it can be built
+// and measured offline on any platform with SSE2 (see offline.cpp).
+// ============================================================================
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// SSE intrinsics
+#include <emmintrin.h>
+#include <xmmintrin.h>
+
+#include "memory.h"
+#include "trace.h"
+
+struct Loudness
+{
+  float integrated; // integrated loudness in LUFS.
+  float truePeak;   // true peak level in dBTP.
+  float rms;        // overall RMS level in dBFS.
+};
+
+// ============================================================================
+// DSP - Planar Buffers
+// Audio data is usually interleaved (i.e. frame by frame), which forces all the
+// DSP code to stride over the channels and defeats the vectorization. Our own
+// processing uses a planar layout instead, where each channel is a contiguous
+// plane of floats starting at a 64-byte boundary, so each DSP stage can run
+// straight SIMD loops over the channels.
+//
+// The data is interleaved only at the boundaries of the pipeline, i.e. when it
+// is passed from/to XAudio2 or written to the output of the portable mixer.
+// ============================================================================
+class PlanarBuffer
+{
+public:
+  PlanarBuffer() = default;
+
+  PlanarBuffer(unsigned int channels, unsigned int frames)
+    : channelCount(channels), frameCount(frames)
+  {
+    // round the planes up to full alignment blocks to keep all planes aligned.
+    const auto block = SIMD_ALIGNMENT / sizeof(float);
+    auto stride = std::max((frames + block - 1) / block * block, block);
+    auto size = channels * stride * sizeof(float);
+    storage.reset(static_cast<float*>(alignedAlloc(std::max(size, size_t(SIMD_ALIGNMENT)), SIMD_ALIGNMENT)));
+    if (!storage) throw std::bad_alloc();
+    std::fill(storage.get(), storage.get() + channels * stride, 0.f);
+    for (auto c = 0u; c < channels; c++)
+      planes.push_back(storage.get() + c * stride);
+  }
+
+  unsigned int channels() const { return channelCount; }
+  unsigned int frames() const { return frameCount; }
+
+  float* channel(unsigned int index) { return planes[index]; }
+  const float* channel(unsigned int index) const { return planes[index]; }
+  float* const* data() { return planes.data(); }
+  const float* const* data() const { return planes.data(); }
+
+  void clear(unsigned int frames)
+  {
+    for (auto plane : planes)
+      std::fill(plane, plane + frames, 0.f);
+  }
+
+private:
+  unsigned int                       channelCount = 0;
+  unsigned int                       frameCount = 0;
+  std::unique_ptr<float, AlignedFree> storage;
+  std::vector<float*>                planes;
+};
+
+inline void deinterleave(const float* input, PlanarBuffer& output, unsigned int frames)
+{
+  const auto channels = output.channels();
+  for (auto c = 0u; c < channels; c++) {
+    auto plane = output.channel(c);
+    for (auto i = 0u; i < frames; i++)
+      plane[i] = input[i * channels + c];
+  }
+}
+
+inline void interleave(const PlanarBuffer& input, float* output, unsigned int frames)
+{
+  const auto channels = input.channels();
+  for (auto c = 0u; c < channels; c++) {
+    auto plane = input.channel(c);
+    for (auto i = 0u; i < frames; i++)
+      output[i * channels + c] = plane[i];
+  }
+}
+
+// ============================================================================
+// DSP - SIMD Reductions
+// Peak and energy measurements are plain reductions over a sample array. These
+// kernels process four samples per SSE instruction and only fall back to the
+// scalar code for the few samples that remain at the end of the array.
+//
+// The energy of a whole file would lose its precision in the float lanes, so
+// the lanes only sum a block of samples at a time into a double accumulator.
+// ============================================================================
+const size_t REDUCTION_BLOCK = 4096;
+
+inline double sumOfSquares(const float* samples, size_t count)
+{
+  auto result = 0.0;
+  auto i = size_t(0);
+  while (i + 4 <= count) {
+    auto sum = _mm_setzero_ps();
+    auto end = std::min(count, i + REDUCTION_BLOCK);
+    for (; i + 4 <= end; i += 4) {
+      auto x = _mm_loadu_ps(samples + i);
+      sum = _mm_add_ps(sum, _mm_mul_ps(x, x));
+    }
+
+    // combine the SIMD lanes of the block.
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    result += (double(lanes[0]) + lanes[1]) + (double(lanes[2]) + lanes[3]);
+  }
+  for (; i < count; i++)
+    result += double(samples[i]) * samples[i];
+  return result;
+}
+
+inline float peakAbs(const float* samples, size_t count)
+{
+  const auto mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  auto peak = _mm_setzero_ps();
+  auto i = size_t(0);
+  for (; i + 4 <= count; i += 4)
+    peak = _mm_max_ps(peak, _mm_and_ps(_mm_loadu_ps(samples + i), mask));
+
+  // combine the SIMD lanes and the remaining samples.
+  float lanes[4];
+  _mm_storeu_ps(lanes, peak);
+  auto result = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+  for (; i < count; i++)
+    result = std::max(result, std::abs(samples[i]));
+  return result;
+}
+
+// ============================================================================
+// DSP - Loudness Analysis
+// Loudness is measured as specified in the ITU-R BS.1770 recommendation which
+// is also used by the EBU R128 and most of the game platform loudness targets.
+//   1. K-weight each channel with a high-shelf and a high-pass biquad filter.
+//   2. Measure the energy of overlapping 400ms blocks (100ms steps).
+//   3. Drop blocks below -70 LUFS (absolute gate).
+//   4. Drop blocks 10 LU below the remaining average (relative gate).
+//   5. The average energy of the remaining blocks is the integrated loudness.
+//
+// Signals shorter than a single 400ms block (e.g. short effects or the prefix
+// of a decode-ahead file) are measured as one block over the whole signal.
+//
+// True peak is estimated by 4x oversampling with a polyphase FIR where the four
+// phases are evaluated at once in a SSE register. The analysis is done during
+// the load so voices can be normalized without any runtime metering.
+// ============================================================================
+struct Biquad
+{
+  float b0, b1, b2, a1, a2;
+  float z1, z2;
+
+  void process(float* samples, size_t count)
+  {
+    for (auto i = 0u; i < count; i++) {
+      auto x = samples[i];
+      auto y = b0 * x + z1;
+      z1 = b1 * x - a1 * y + z2;
+      z2 = b2 * x - a2 * y;
+      samples[i] = y;
+    }
+  }
+};
+
+// construct the K-weighting filter pair for the given sample rate.
+inline void kWeightingFilters(double rate, Biquad& shelf, Biquad& highpass)
+{
+  const auto pi = 3.14159265358979323846;
+
+  // stage 1: high-shelf filter which models the acoustic effects of the head.
+  auto k = std::tan(pi * 1681.974450955533 / rate);
+  auto q = 0.7071752369554196;
+  auto vh = std::pow(10.0, 3.999843853973347 / 20.0);
+  auto vb = std::pow(vh, 0.4996667741545416);
+  auto a0 = 1.0 + k / q + k * k;
+  shelf = {
+    float((vh + vb * k / q + k * k) / a0),
+    float(2.0 * (k * k - vh) / a0),
+    float((vh - vb * k / q + k * k) / a0),
+    float(2.0 * (k * k - 1.0) / a0),
+    float((1.0 - k / q + k * k) / a0),
+    0.f, 0.f
+  };
+
+  // stage 2: high-pass filter (RLB weighting) to ignore the lowest frequencies.
+  k = std::tan(pi * 38.13547087602444 / rate);
+  q = 0.5003270373238773;
+  a0 = 1.0 + k / q + k * k;
+  highpass = {
+    1.f, -2.f, 1.f,
+    float(2.0 * (k * k - 1.0) / a0),
+    float((1.0 - k / q + k * k) / a0),
+    0.f, 0.f
+  };
+}
+
+// get the BS.1770 weight of the channel (LFE is ignored, surrounds boosted).
+inline double channelWeight(unsigned int channel, unsigned int channels)
+{
+  if (channels < 6 || channel < 3) return 1.0;
+  return channel == 3 ? 0.0 : 1.41;
+}
+
+// estimate the true peak of the channel with a 4x oversampling interpolator.
+inline float truePeak(const float* samples, size_t count)
+{
+  const auto phases = 4;
+  const auto taps = 12;
+  const auto pi = 3.14159265358979323846;
+
+  // build a windowed-sinc interpolator where each SSE lane holds one phase.
+  static const auto coefficients = [&] {
+    std::vector<float> result(taps * phases);
+    for (auto m = 0; m < taps * phases; m++) {
+      auto t = (m - (taps * phases - 1) / 2.0) / phases;
+      auto sinc = t == 0.0 ? 1.0 : std::sin(pi * t) / (pi * t);
+      auto window = 0.5 - 0.5 * std::cos(2.0 * pi * (m + 0.5) / (taps * phases));
+      result[m] = float(sinc * window);
+    }
+    return result;
+  }();
+  __m128 h[taps];
+  for (auto tap = 0; tap < taps; tap++)
+    h[tap] = _mm_loadu_ps(&coefficients[tap * phases]);
+
+  const auto mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  auto peak = _mm_set1_ps(peakAbs(samples, count));
+  for (auto i = size_t(taps); i < count; i++) {
+    auto y = _mm_setzero_ps();
+    for (auto tap = 0; tap < taps; tap++)
+      y = _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(samples[i - tap]), h[tap]));
+    peak = _mm_max_ps(peak, _mm_and_ps(y, mask));
+  }
+
+  float lanes[4];
+  _mm_storeu_ps(lanes, peak);
+  return std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+}
+
+// measure the loudness of the planes, which get K-weighted in place.
+inline Loudness analyseLoudness(PlanarBuffer& planes, unsigned int rate)
+{
+  const auto silence = -std::numeric_limits<float>::infinity();
+  const auto channels = planes.channels();
+  auto frames = size_t(planes.frames());
+
+  // measure the overall RMS and the true peak from the unweighted signal.
+  Loudness loudness = { silence, silence, silence };
+  auto energy = 0.0;
+  auto peak = 0.f;
+  for (auto c = 0u; c < channels; c++) {
+    energy += sumOfSquares(planes.channel(c), frames);
+    peak = std::max(peak, truePeak(planes.channel(c), frames));
+  }
+  if (frames == 0 || energy <= 0.0)
+    return loudness;
+  loudness.rms = float(10.0 * std::log10(energy / (frames * channels)));
+  loudness.truePeak = 20.f * std::log10(peak);
+
+  // apply K-weighting and measure the weighted energy of each 100ms step.
+  const auto step = size_t(rate / 10);
+  const auto steps = frames / step;
+  std::vector<double> stepEnergy(steps, 0.0);
+  auto weighted = 0.0;
+  for (auto c = 0u; c < channels; c++) {
+    Biquad shelf, highpass;
+    kWeightingFilters(rate, shelf, highpass);
+    shelf.process(planes.channel(c), frames);
+    highpass.process(planes.channel(c), frames);
+    auto weight = channelWeight(c, channels);
+    for (auto s = 0u; s < steps; s++)
+      stepEnergy[s] += weight * sumOfSquares(planes.channel(c) + s * step, step);
+    if (steps < 4)
+      weighted += weight * sumOfSquares(planes.channel(c), frames);
+  }
+
+  // build the overlapping 400ms gating blocks and apply the absolute gate.
+  std::vector<double> blocks;
+  auto gate = [&](double power) {
+    if (-0.691 + 10.0 * std::log10(power) > -70.0)
+      blocks.push_back(power);
+  };
+  for (auto s = size_t(3); s < steps; s++)
+    gate((stepEnergy[s - 3] + stepEnergy[s - 2] + stepEnergy[s - 1] + stepEnergy[s]) / (4 * step));
+  if (steps < 4)
+    gate(weighted / frames);
+  if (blocks.empty())
+    return loudness;
+
+  // apply the relative gate and average the energy of the remaining blocks.
+  auto mean = 0.0;
+  for (auto power : blocks) mean += power;
+  auto threshold = mean / blocks.size() * std::pow(10.0, -10.0 / 10.0);
+  auto gated = 0.0;
+  auto count = 0u;
+  for (auto power : blocks) {
+    if (power > threshold) {
+      gated += power;
+      count++;
+    }
+  }
+  loudness.integrated = float(-0.691 + 10.0 * std::log10(gated / count));
+  return loudness;
+}
+
+// ============================================================================
+// DSP - Loudness Normalization
+// The normalization gain brings the integrated loudness of a file to a target
+// level, while ensuring that the true peak does not exceed a given ceiling.
+// ============================================================================
+const float LOUDNESS_TARGET = -18.f;   // LUFS
+const float TRUE_PEAK_CEILING = -1.f;  // dBTP
+
+inline float normalizingGain(const Loudness& loudness)
+{
+  // silent files can't be measured, so don't touch them at all.
+  if (!std::isfinite(loudness.integrated))
+    return 1.f;
+
+  auto gain = LOUDNESS_TARGET - loudness.integrated;
+  gain = std::min(gain, TRUE_PEAK_CEILING - loudness.truePeak);
+  return std::pow(10.f, gain / 20.f);
+}
+
+// ============================================================================
+// DSP - Block Processing
+// All our own effects are written as portable DSP blocks which don't depend on
+// XAudio2 or any other Windows API. A block is first prepared with the format
+// and the maximum block size it will be fed with, so it can allocate all its
+// memory up front, and then it processes planar float blocks in-place.
+//
+// Because blocks are portable, the same code can be run offline (to measure or
+// to verify the output) and within XAudio2 by wrapping it into a XAPO object.
+//
+// The tail of a block is the number of frames its output may still carry some
+// signal after its input has gone silent. Once the input has been silent for
+// longer than the tail, the hosts skip the block and call skip instead, so the
+// block may reset its state. Blocks with an unknown tail are never skipped.
+// ============================================================================
+const unsigned int DSP_TAIL_INFINITE = std::numeric_limits<unsigned int>::max();
+
+class DspBlock
+{
+public:
+  virtual ~DspBlock() = default;
+  virtual void prepare(unsigned int channels, unsigned int sampleRate, unsigned int maxFrames) = 0;
+  virtual void process(float* const* channels, unsigned int frames) = 0;
+  virtual unsigned int tail() const { return DSP_TAIL_INFINITE; }
+  virtual void skip(unsigned int) {}
+};
+
+// add frames into a tail or a silence length, saturating at the infinite tail.
+inline unsigned int addFrames(unsigned int a, unsigned int b)
+{
+  return a >= DSP_TAIL_INFINITE - b ? DSP_TAIL_INFINITE : a + b;
+}
+
+// multiply a plane by a per-frame gain.
+inline void applyGains(float* samples, const float* gains, unsigned int frames)
+{
+  auto i = 0u;
+  for (; i + 4 <= frames; i += 4)
+    _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), _mm_loadu_ps(gains + i)));
+  for (; i < frames; i++)
+    samples[i] *= gains[i];
+}
+
+// ============================================================================
+// DSP - Dynamics (Compressor & Limiter)
+// Dynamics processing reduces the gain of the signal whenever it exceeds the
+// threshold level. The compressor reduces the gain by the given ratio, while a
+// limiter uses an infinite ratio so that the signal never exceeds threshold.
+//   threshold...The level (dBFS) where the gain reduction starts.
+//   ratio.......The input/output ratio of the signal above the threshold.
+//   attack......The time (ms) to react on signal exceeding threshold.
+//   release.....The time (ms) to recover from the gain reduction.
+//   lookahead...The time (ms) the output is delayed to see peaks in advance.
+//   makeup......The gain (dB) applied after the gain reduction.
+//
+// The detector is linked (all channels share the same gain) so that stereo and
+// surround images do not shift. Lookahead is implemented by delaying the signal
+// and by taking the minimum of the required gains over the lookahead window.
+// With a lookahead the attack is a moving average over the lookahead window,
+// which guarantees that the gain has reached the target when the peak arrives.
+// ============================================================================
+struct DynamicsParameters
+{
+  float threshold;
+  float ratio;
+  float attack;
+  float release;
+  float lookahead;
+  float makeup;
+};
+
+// the detector reads sample peaks, which stay well above the loudness: a sound
+// normalised to -18 LUFS typically peaks around -12..-6dBFS. So the compressor
+// starts at -10dBFS to act on the sounds that pile up rather than on every
+// sound, and it adds no makeup gain that would undo the normalisation.
+const DynamicsParameters MASTER_COMPRESSOR = { -10.f, 3.f, 10.f, 150.f, 0.f, 0.f };
+const DynamicsParameters MASTER_LIMITER = { -1.f, INFINITY, 5.f, 80.f, 5.f, 0.f };
+
+class Dynamics : public DspBlock
+{
+public:
+  explicit Dynamics(const DynamicsParameters& parameters) : parameters(parameters) {}
+
+  void prepare(unsigned int channels, unsigned int sampleRate, unsigned int maxFrames) override
+  {
+    auto frames = [&](float ms) { return static_cast<unsigned int>(ms * 0.001f * sampleRate); };
+    auto coefficient = [&](float ms) { return ms > 0.f ? std::exp(-1.f / (ms * 0.001f * sampleRate)) : 0.f; };
+
+    this->channels = channels;
+    threshold = std::pow(10.f, parameters.threshold / 20.f);
+    slope = std::isinf(parameters.ratio) ? 1.f : 1.f - 1.f / parameters.ratio;
+    makeup = std::pow(10.f, parameters.makeup / 20.f);
+    attack = coefficient(parameters.attack);
+    release = coefficient(parameters.release);
+    lookahead = frames(parameters.lookahead);
+
+    // allocate all the memory required by the processing.
+    delay = PlanarBuffer(channels, lookahead);
+    window.assign(lookahead + 2, Entry{ 1.f, 0 });
+    history.assign(lookahead, 1.f);
+    gains.assign(maxFrames, 1.f);
+    delayPosition = 0;
+    windowFirst = windowCount = 0;
+    historyPosition = 0;
+    frame = 0;
+    gain = 1.f;
+    average = lookahead;
+  }
+
+  void process(float* const* samples, unsigned int frames) override
+  {
+    assert(frames <= gains.size());
+
+    // detect the peak of each frame over all the channels (four at a time).
+    const auto mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    auto i = 0u;
+    for (; i + 4 <= frames; i += 4) {
+      auto peak = _mm_setzero_ps();
+      for (auto c = 0u; c < channels; c++)
+        peak = _mm_max_ps(peak, _mm_and_ps(_mm_loadu_ps(samples[c] + i), mask));
+      _mm_storeu_ps(&gains[i], peak);
+    }
+    for (; i < frames; i++) {
+      gains[i] = 0.f;
+      for (auto c = 0u; c < channels; c++)
+        gains[i] = std::max(gains[i], std::abs(samples[c][i]));
+    }
+
+    // convert the undelayed input peaks into the required gains.
+    for (i = 0u; i < frames; i++)
+      gains[i] = targetGain(gains[i]);
+
+    // take the minimum over the lookahead window and smooth the result.
+    for (i = 0u; i < frames; i++) {
+      auto target = slidingMinimum(gains[i]);
+      if (lookahead == 0) {
+        gain = target + (gain - target) * (target < gain ? attack : release);
+        gains[i] = gain * makeup;
+      } else {
+        gain = target < gain ? target : target + (gain - target) * release;
+        average += gain - history[historyPosition];
+        history[historyPosition] = gain;
+        historyPosition = (historyPosition + 1) % lookahead;
+        gains[i] = float(average / lookahead) * makeup;
+      }
+    }
+
+    // delay the signal by swapping the block through the lookahead buffer.
+    if (lookahead > 0) {
+      for (i = 0u; i < frames; ) {
+        auto count = std::min(frames - i, lookahead - delayPosition);
+        for (auto c = 0u; c < channels; c++) {
+          auto block = samples[c] + i;
+          std::swap_ranges(block, block + count, delay.channel(c) + delayPosition);
+        }
+        delayPosition = (delayPosition + count) % lookahead;
+        i += count;
+      }
+    }
+    for (auto c = 0u; c < channels; c++)
+      applyGains(samples[c], gains.data(), frames);
+  }
+
+  // the lookahead buffer is empty after the tail, so only the detector is left
+  // and it is reset as if the gain had been fully released during the silence.
+  unsigned int tail() const override { return lookahead; }
+
+  void skip(unsigned int) override
+  {
+    std::fill(history.begin(), history.end(), 1.f);
+    windowFirst = windowCount = 0;
+    historyPosition = 0;
+    gain = 1.f;
+    average = lookahead;
+  }
+
+private:
+  struct Entry
+  {
+    float        gain;
+    unsigned int frame;
+  };
+
+  float targetGain(float peak) const
+  {
+    if (peak <= threshold) return 1.f;
+    return std::pow(threshold / peak, slope);
+  }
+
+  // a monotonic queue which keeps track of the minimum of the lookahead window.
+  float slidingMinimum(float value)
+  {
+    auto capacity = static_cast<unsigned int>(window.size());
+    while (windowCount > 0 && window[(windowFirst + windowCount - 1) % capacity].gain >= value)
+      windowCount--;
+    window[(windowFirst + windowCount) % capacity] = { value, frame };
+    windowCount++;
+    if (frame - window[windowFirst].frame > lookahead) {
+      windowFirst = (windowFirst + 1) % capacity;
+      windowCount--;
+    }
+    frame++;
+    return window[windowFirst].gain;
+  }
+
+  DynamicsParameters parameters;
+  unsigned int       channels = 0;
+  float              threshold = 1.f;
+  float              slope = 0.f;
+  float              makeup = 1.f;
+  float              attack = 0.f;
+  float              release = 0.f;
+  float              gain = 1.f;
+  unsigned int       lookahead = 0;
+  unsigned int       delayPosition = 0;
+  unsigned int       windowFirst = 0;
+  unsigned int       windowCount = 0;
+  unsigned int       historyPosition = 0;
+  unsigned int       frame = 0;
+  double             average = 0.0;
+  PlanarBuffer       delay;
+  std::vector<Entry> window;
+  std::vector<float> history;
+  std::vector<float> gains;
+};
+
+// ============================================================================
+// DSP - Sidechain Ducking
+// A sidechain compressor whose detector listens to a key signal (e.g. dialogue)
+// and whose gain is applied to other signals (e.g. music and effects). The gain
+// curve of each block is computed once from the key, so any number of targets
+// can share the same envelope follower and are ducked in sync.
+//   threshold...The key level (dBFS) where the ducking starts.
+//   ratio.......The key/target ratio of the level above the threshold.
+//   range.......The maximum gain reduction (dB).
+//   attack......The time (ms) to duck when the key exceeds the threshold.
+//   release.....The time (ms) to recover after the key has gone quiet.
+// ============================================================================
+struct DuckingParameters
+{
+  float threshold;
+  float ratio;
+  float range;
+  float attack;
+  float release;
+};
+
+const DuckingParameters DIALOGUE_DUCKING = { -40.f, 4.f, 12.f, 20.f, 400.f };
+
+class Sidechain
+{
+public:
+  explicit Sidechain(const DuckingParameters& parameters) : parameters(parameters) {}
+
+  void prepare(unsigned int sampleRate, unsigned int maxFrames)
+  {
+    auto coefficient = [&](float ms) { return ms > 0.f ? std::exp(-1.f / (ms * 0.001f * sampleRate)) : 0.f; };
+    threshold = std::pow(10.f, parameters.threshold / 20.f);
+    slope = 1.f - 1.f / parameters.ratio;
+    floor = std::pow(10.f, -parameters.range / 20.f);
+    attack = coefficient(parameters.attack);
+    release = coefficient(parameters.release);
+    gains.assign(maxFrames, 1.f);
+    gain = 1.f;
+  }
+
+  // follow the key signal and compute the gain curve of the block.
+  void analyze(const float* const* key, unsigned int channels, unsigned int frames)
+  {
+    assert(frames <= gains.size());
+    const auto mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    auto i = 0u;
+    for (; i + 4 <= frames; i += 4) {
+      auto peak = _mm_setzero_ps();
+      for (auto c = 0u; c < channels; c++)
+        peak = _mm_max_ps(peak, _mm_and_ps(_mm_loadu_ps(key[c] + i), mask));
+      _mm_storeu_ps(&gains[i], peak);
+    }
+    for (; i < frames; i++) {
+      gains[i] = 0.f;
+      for (auto c = 0u; c < channels; c++)
+        gains[i] = std::max(gains[i], std::abs(key[c][i]));
+    }
+    for (i = 0u; i < frames; i++) {
+      auto target = gains[i] <= threshold ? 1.f : std::max(floor, std::pow(threshold / gains[i], slope));
+      gain = target + (gain - target) * (target < gain ? attack : release);
+      gains[i] = gain;
+    }
+  }
+
+  // duck a target signal with the gain curve of the latest analyzed block.
+  void apply(float* const* samples, unsigned int channels, unsigned int frames) const
+  {
+    for (auto c = 0u; c < channels; c++)
+      applyGains(samples[c], gains.data(), frames);
+  }
+
+  float currentGain() const { return gain; }
+
+private:
+  DuckingParameters  parameters;
+  float              threshold = 1.f;
+  float              slope = 0.f;
+  float              floor = 1.f;
+  float              attack = 0.f;
+  float              release = 0.f;
+  float              gain = 1.f;
+  std::vector<float> gains;
+};
+
+// ============================================================================
+// DSP - Biquad Filter Bank
+// XAudio2 offers a single state-variable filter per voice. The filter bank runs
+// the same kind of biquad (e.g. an occlusion low-pass or an EQ band) for many
+// voices at once, with four voices processed in the lanes of a SSE register.
+// Four frames of each four voices are loaded and transposed, so that the lanes
+// hold the same frame of the different voices, which keeps the recursion of
+// each filter in its own lane. The coefficients are updated in batches once per
+// frame (RBJ cookbook formulas) and are kept in planes of their own.
+// ============================================================================
+class BiquadBank
+{
+public:
+  explicit BiquadBank(unsigned int count)
+    : count(count), padded((count + 3) & ~3u),
+      memory(static_cast<float*>(alignedAlloc(sizeof(float) * padded * PLANES, SIMD_ALIGNMENT)))
+  {
+    if (!memory) throw std::bad_alloc();
+    std::fill(memory.get(), memory.get() + padded * PLANES, 0.f);
+    std::fill(plane(B0), plane(B0) + padded, 1.f);
+  }
+
+  unsigned int size() const { return count; }
+
+  // clear the filter states e.g. when the voices are reassigned.
+  void reset()
+  {
+    std::fill(plane(Z1), plane(Z1) + padded, 0.f);
+    std::fill(plane(Z2), plane(Z2) + padded, 0.f);
+  }
+
+  // update the filters into low-pass filters with the given cutoffs and Qs.
+  void setLowpass(const float* cutoff, const float* q, float sampleRate)
+  {
+    const auto pi = 3.14159265358979323846f;
+    for (auto i = 0u; i < count; i++) {
+      auto w = 2.f * pi * cutoff[i] / sampleRate;
+      auto cosw = std::cos(w);
+      auto alpha = std::sin(w) / (2.f * q[i]);
+      set(i, (1.f - cosw) / 2.f, 1.f - cosw, (1.f - cosw) / 2.f, 1.f + alpha, -2.f * cosw, 1.f - alpha);
+    }
+  }
+
+  // update the filters into peaking EQ bands with the given gains (dB).
+  void setPeaking(const float* frequency, const float* q, const float* gain, float sampleRate)
+  {
+    const auto pi = 3.14159265358979323846f;
+    for (auto i = 0u; i < count; i++) {
+      auto a = std::pow(10.f, gain[i] / 40.f);
+      auto w = 2.f * pi * frequency[i] / sampleRate;
+      auto cosw = std::cos(w);
+      auto alpha = std::sin(w) / (2.f * q[i]);
+      set(i, 1.f + alpha * a, -2.f * cosw, 1.f - alpha * a, 1.f + alpha / a, -2.f * cosw, 1.f - alpha / a);
+    }
+  }
+
+  // filter the signals in place, where each signal goes through its own filter.
+  void process(float* const* signals, unsigned int frames)
+  {
+    for (auto g = 0u; g < count; g += 4) {
+      auto lanes = std::min(4u, count - g);
+      float* s[4];
+      for (auto l = 0u; l < 4; l++)
+        s[l] = signals[g + std::min(l, lanes - 1)];
+
+      auto b0 = _mm_load_ps(plane(B0) + g);
+      auto b1 = _mm_load_ps(plane(B1) + g);
+      auto b2 = _mm_load_ps(plane(B2) + g);
+      auto a1 = _mm_load_ps(plane(A1) + g);
+      auto a2 = _mm_load_ps(plane(A2) + g);
+      auto z1 = _mm_load_ps(plane(Z1) + g);
+      auto z2 = _mm_load_ps(plane(Z2) + g);
+      auto step = [&](__m128 x) {
+        auto y = _mm_add_ps(_mm_mul_ps(b0, x), z1);
+        z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), z2);
+        z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+        return y;
+      };
+
+      // four frames of four voices at a time, transposed into the frame order.
+      auto t = 0u;
+      for (; t + 4 <= frames; t += 4) {
+        auto x0 = _mm_loadu_ps(s[0] + t);
+        auto x1 = _mm_loadu_ps(s[1] + t);
+        auto x2 = _mm_loadu_ps(s[2] + t);
+        auto x3 = _mm_loadu_ps(s[3] + t);
+        _MM_TRANSPOSE4_PS(x0, x1, x2, x3);
+        x0 = step(x0);
+        x1 = step(x1);
+        x2 = step(x2);
+        x3 = step(x3);
+        _MM_TRANSPOSE4_PS(x0, x1, x2, x3);
+        __m128 y[4] = { x0, x1, x2, x3 };
+        for (auto l = 0u; l < lanes; l++)
+          _mm_storeu_ps(s[l] + t, y[l]);
+      }
+
+      // the remaining frames are gathered one frame at a time.
+      for (; t < frames; t++) {
+        alignas(16) float x[4];
+        for (auto l = 0u; l < 4; l++)
+          x[l] = s[l][t];
+        _mm_store_ps(x, step(_mm_load_ps(x)));
+        for (auto l = 0u; l < lanes; l++)
+          s[l][t] = x[l];
+      }
+
+      _mm_store_ps(plane(Z1) + g, z1);
+      _mm_store_ps(plane(Z2) + g, z2);
+    }
+  }
+
+private:
+  enum { B0, B1, B2, A1, A2, Z1, Z2, PLANES };
+
+  float* plane(unsigned int index) { return memory.get() + index * padded; }
+
+  void set(unsigned int i, float b0, float b1, float b2, float a0, float a1, float a2)
+  {
+    plane(B0)[i] = b0 / a0;
+    plane(B1)[i] = b1 / a0;
+    plane(B2)[i] = b2 / a0;
+    plane(A1)[i] = a1 / a0;
+    plane(A2)[i] = a2 / a0;
+  }
+
+  unsigned int                      count;
+  unsigned int                      padded;
+  std::unique_ptr<float, AlignedFree> memory;
+};
+
+// ============================================================================
+// DSP - FFT
+// An iterative radix-2 complex FFT over split (planar) real and imaginary data.
+// The twiddle factors of each stage are stored contiguously, where the stage
+// with the half-length h uses the entries [h, 2h), so the butterflies of the
+// longer stages process four twiddles per SSE instruction. The inverse is not
+// scaled, as the callers can usually fold the 1/N into their own gains.
+// ============================================================================
+class Fft
+{
+public:
+  explicit Fft(unsigned int size)
+    : n(size), twiddleRe(size), twiddleIm(size), reversed(size)
+  {
+    assert(size >= 2 && (size & (size - 1)) == 0);
+    const auto pi = 3.14159265358979323846;
+    for (auto half = 1u; half < n; half *= 2) {
+      for (auto k = 0u; k < half; k++) {
+        twiddleRe[half + k] = float(std::cos(-pi * k / half));
+        twiddleIm[half + k] = float(std::sin(-pi * k / half));
+      }
+    }
+    auto bits = 0u;
+    while ((1u << bits) < n)
+      bits++;
+    for (auto i = 0u; i < n; i++) {
+      auto r = 0u;
+      for (auto b = 0u; b < bits; b++)
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      reversed[i] = r;
+    }
+  }
+
+  unsigned int size() const { return n; }
+
+  void transform(float* re, float* im, bool inverse) const
+  {
+    for (auto i = 0u; i < n; i++) {
+      auto j = reversed[i];
+      if (i < j) {
+        std::swap(re[i], re[j]);
+        std::swap(im[i], im[j]);
+      }
+    }
+
+    const auto sign = inverse ? -1.f : 1.f;
+    const auto signs = _mm_set1_ps(sign);
+    for (auto half = 1u; half < n; half *= 2) {
+      auto wr = twiddleRe.data() + half;
+      auto wi = twiddleIm.data() + half;
+      for (auto i = 0u; i < n; i += half * 2) {
+        auto ar = re + i, ai = im + i, br = ar + half, bi = ai + half;
+        auto k = 0u;
+        for (; half >= 4 && k < half; k += 4) {
+          auto twr = _mm_loadu_ps(wr + k);
+          auto twi = _mm_mul_ps(_mm_loadu_ps(wi + k), signs);
+          auto xr = _mm_loadu_ps(br + k);
+          auto xi = _mm_loadu_ps(bi + k);
+          auto tr = _mm_sub_ps(_mm_mul_ps(xr, twr), _mm_mul_ps(xi, twi));
+          auto ti = _mm_add_ps(_mm_mul_ps(xr, twi), _mm_mul_ps(xi, twr));
+          auto yr = _mm_loadu_ps(ar + k);
+          auto yi = _mm_loadu_ps(ai + k);
+          _mm_storeu_ps(br + k, _mm_sub_ps(yr, tr));
+          _mm_storeu_ps(bi + k, _mm_sub_ps(yi, ti));
+          _mm_storeu_ps(ar + k, _mm_add_ps(yr, tr));
+          _mm_storeu_ps(ai + k, _mm_add_ps(yi, ti));
+        }
+        for (; k < half; k++) {
+          auto twi = wi[k] * sign;
+          auto tr = br[k] * wr[k] - bi[k] * twi;
+          auto ti = br[k] * twi + bi[k] * wr[k];
+          br[k] = ar[k] - tr;
+          bi[k] = ai[k] - ti;
+          ar[k] += tr;
+          ai[k] += ti;
+        }
+      }
+    }
+  }
+
+private:
+  unsigned int              n;
+  std::vector<float>        twiddleRe;
+  std::vector<float>        twiddleIm;
+  std::vector<unsigned int> reversed;
+};
+
+// ============================================================================
+// DSP - Resampling
+// Converts planar samples to another sample rate with a Hann windowed sinc. It
+// is meant for the sample data that is converted once (e.g. impulse responses)
+// rather than for streaming, so the filter weights are computed for each frame.
+// The cutoff is at the lower of the two Nyquist frequencies, so downsampling
+// doesn't alias.
+// ============================================================================
+const unsigned int RESAMPLE_ZERO_CROSSINGS = 32;
+
+inline PlanarBuffer resample(const PlanarBuffer& input, unsigned int fromRate, unsigned int toRate)
+{
+  const auto pi = 3.14159265358979323846;
+  const auto ratio = double(toRate) / fromRate;
+  const auto cutoff = std::min(1.0, ratio);
+  const auto radius = RESAMPLE_ZERO_CROSSINGS / cutoff;
+  const auto frames = static_cast<unsigned int>(std::ceil(input.frames() * ratio));
+
+  PlanarBuffer output(input.channels(), frames);
+  std::vector<double> weights;
+  for (auto i = 0u; i < frames; i++) {
+    auto center = i / ratio;
+    auto first = std::max(0, static_cast<int>(std::ceil(center - radius)));
+    auto last = std::min(static_cast<int>(input.frames()) - 1, static_cast<int>(std::floor(center + radius)));
+    weights.clear();
+    for (auto j = first; j <= last; j++) {
+      auto x = pi * (j - center) * cutoff;
+      auto sinc = x == 0.0 ? 1.0 : std::sin(x) / x;
+      weights.push_back(cutoff * sinc * (0.5 + 0.5 * std::cos(pi * (j - center) / radius)));
+    }
+    for (auto c = 0u; c < input.channels(); c++) {
+      auto sum = 0.0;
+      for (auto j = first; j <= last; j++)
+        sum += input.channel(c)[j] * weights[j - first];
+      output.channel(c)[i] = static_cast<float>(sum);
+    }
+  }
+  return output;
+}
+
+// ============================================================================
+// DSP - Convolution Reverb
+// A uniformly partitioned overlap-save convolution. The impulse response is cut
+// into partitions of the partition size, whose spectra are multiplied with the
+// spectra of the latest input blocks, kept in a frequency-domain delay line.
+// The products are accumulated with SIMD complex multiply-adds, so the cost of
+// a longer impulse response is a longer but cheap accumulation loop.
+//
+// The partition size trades the latency (one partition) against the CPU cost:
+// the smaller the partitions, the more often the transforms are run and the
+// more partitions are accumulated for each output block. As the input is real,
+// only the first half of the spectrum is accumulated. The impulse response is
+// given as planar samples with a pre-delay, so an impulse response loaded like
+// any other file gets its trimmed leading silence (the offset) restored. An
+// impulse response recorded at another rate than the mix is resampled to the
+// mix rate when the block is prepared, so it keeps its pitch and length.
+// ============================================================================
+struct ConvolutionParameters
+{
+  unsigned int partition; // frames (power of two)
+  float        wet;
+  float        dry;
+};
+
+const ConvolutionParameters CONVOLUTION_SEND = { 512, 1.f, 0.f };
+
+class ConvolutionReverb : public DspBlock
+{
+public:
+  ConvolutionReverb(PlanarBuffer impulse, unsigned int impulseRate, unsigned int predelay,
+                    const ConvolutionParameters& params)
+    : params(params), impulse(std::move(impulse)), predelay(predelay),
+      impulseRate(impulseRate), fft(params.partition * 2)
+  {
+  }
+
+  void prepare(unsigned int channels, unsigned int sampleRate, unsigned int) override
+  {
+    if (sampleRate != impulseRate) {
+      impulse = resample(impulse, impulseRate, sampleRate);
+      predelay = static_cast<unsigned int>(uint64_t(predelay) * sampleRate / impulseRate);
+      impulseRate = sampleRate;
+    }
+    this->channels = channels;
+    block = params.partition;
+    bins = (block + 1 + 3) & ~3u;
+    auto length = predelay + impulse.frames();
+    partitions = std::max(1u, (length + block - 1) / block);
+    auto spectrum = size_t(2) * bins;
+
+    filters = allocate(impulse.channels() * partitions * spectrum);
+    history = allocate(channels * partitions * spectrum);
+    input = allocate(channels * block * 2);
+    output = allocate(channels * block);
+    scratch = allocate(block * 4 + spectrum);
+    position = 0;
+    current = 0;
+
+    // transform the impulse partitions, with the 1/N of the inverse folded in.
+    auto re = scratch.get(), im = re + block * 2;
+    const auto scale = 1.f / (block * 2);
+    for (auto c = 0u; c < impulse.channels(); c++) {
+      for (auto p = 0u; p < partitions; p++) {
+        std::fill(re, re + block * 4, 0.f);
+        for (auto i = 0u; i < block; i++) {
+          auto frame = p * block + i;
+          if (frame >= predelay && frame < length)
+            re[i] = impulse.channel(c)[frame - predelay] * scale;
+        }
+        fft.transform(re, im, false);
+        auto h = filter(c, p);
+        std::fill(h, h + spectrum, 0.f);
+        std::copy(re, re + block + 1, h);
+        std::copy(im, im + block + 1, h + bins);
+      }
+    }
+  }
+
+  void process(float* const* samples, unsigned int frames) override
+  {
+    for (auto done = 0u; done < frames;) {
+      auto count = std::min(frames - done, block - position);
+      for (auto c = 0u; c < channels; c++) {
+        auto x = samples[c] + done;
+        auto y = output.get() + c * block + position;
+        std::copy(x, x + count, input.get() + c * block * 2 + block + position);
+        for (auto i = 0u; i < count; i++)
+          x[i] = params.dry * x[i] + params.wet * y[i];
+      }
+      position += count;
+      done += count;
+      if (position == block) {
+        convolve();
+        position = 0;
+      }
+    }
+  }
+
+  // the input blocks, the spectra of the delay line and the output are zeros
+  // after the impulse response and the latency have passed.
+  unsigned int tail() const override { return (partitions + 2) * block; }
+
+private:
+  static std::unique_ptr<float, AlignedFree> allocate(size_t count)
+  {
+    auto memory = static_cast<float*>(alignedAlloc(count * sizeof(float), SIMD_ALIGNMENT));
+    if (!memory) throw std::bad_alloc();
+    std::fill(memory, memory + count, 0.f);
+    return std::unique_ptr<float, AlignedFree>(memory);
+  }
+
+  float* filter(unsigned int channel, unsigned int partition)
+  {
+    return filters.get() + (size_t(channel) * partitions + partition) * 2 * bins;
+  }
+
+  float* spectrum(unsigned int channel, unsigned int slot)
+  {
+    return history.get() + (size_t(channel) * partitions + slot) * 2 * bins;
+  }
+
+  // transform the latest input block and convolve it into the next output block.
+  void convolve()
+  {
+    TraceScope trace("convolution");
+    const auto n = block * 2;
+    auto re = scratch.get(), im = re + n, accRe = im + n, accIm = accRe + bins;
+    for (auto c = 0u; c < channels; c++) {
+      auto x = input.get() + c * n;
+      std::copy(x, x + n, re);
+      std::fill(im, im + n, 0.f);
+      fft.transform(re, im, false);
+      auto latest = spectrum(c, current);
+      std::copy(re, re + bins, latest);
+      std::copy(im, im + bins, latest + bins);
+
+      // accumulate the products of the input spectra and the impulse partitions.
+      std::fill(accRe, accRe + bins * 2, 0.f);
+      for (auto p = 0u; p < partitions; p++) {
+        auto xs = spectrum(c, (current + partitions - p) % partitions);
+        auto hs = filter(c % impulse.channels(), p);
+        for (auto k = 0u; k < bins; k += 4) {
+          auto xr = _mm_load_ps(xs + k), xi = _mm_load_ps(xs + bins + k);
+          auto hr = _mm_load_ps(hs + k), hi = _mm_load_ps(hs + bins + k);
+          auto ar = _mm_load_ps(accRe + k), ai = _mm_load_ps(accIm + k);
+          ar = _mm_add_ps(ar, _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi)));
+          ai = _mm_add_ps(ai, _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr)));
+          _mm_store_ps(accRe + k, ar);
+          _mm_store_ps(accIm + k, ai);
+        }
+      }
+
+      // rebuild the conjugate symmetric half and keep the valid (last) half.
+      for (auto k = 0u; k <= block; k++) {
+        re[k] = accRe[k];
+        im[k] = accIm[k];
+      }
+      for (auto k = block + 1; k < n; k++) {
+        re[k] = accRe[n - k];
+        im[k] = -accIm[n - k];
+      }
+      fft.transform(re, im, true);
+      std::copy(re + block, re + n, output.get() + c * block);
+
+      // the current block becomes the previous half of the next input.
+      std::copy(x + block, x + n, x);
+    }
+    current = (current + 1) % partitions;
+  }
+
+  ConvolutionParameters               params;
+  PlanarBuffer                        impulse;
+  unsigned int                        predelay;
+  unsigned int                        impulseRate;
+  Fft                                 fft;
+  unsigned int                        channels = 0;
+  unsigned int                        block = 0;
+  unsigned int                        bins = 0;
+  unsigned int                        partitions = 0;
+  unsigned int                        position = 0;
+  unsigned int                        current = 0;
+  std::unique_ptr<float, AlignedFree> filters;
+  std::unique_ptr<float, AlignedFree> history;
+  std::unique_ptr<float, AlignedFree> input;
+  std::unique_ptr<float, AlignedFree> output;
+  std::unique_ptr<float, AlignedFree> scratch;
+};
+
+// ============================================================================
+// DSP - Feedback Delay Network Reverb
+// A lightweight algorithmic reverb for the submix buses of reverb zones. The
+// input is fed into 8 or 16 delay lines whose outputs are low-pass damped,
+// mixed with a Hadamard matrix and fed back with gains derived from the decay
+// time. The lines are processed as the lanes of SSE registers: the delay memory
+// is shared and interleaved, so each frame writes one row of all the lines (a
+// single cache line with 16 lines) and only the reads of the lines with their
+// different lengths are gathered one by one.
+// ============================================================================
+struct FdnParameters
+{
+  float size;    // scale of the delay lengths
+  float decay;   // RT60 (seconds)
+  float damping; // high frequency damping (0...1)
+  float wet;
+  float dry;
+};
+
+const FdnParameters FDN_ROOM = { 1.f, 1.2f, 0.3f, 1.f, 0.f };
+
+template <unsigned int Lines>
+class FdnReverb : public DspBlock
+{
+  static_assert(Lines == 8 || Lines == 16, "the network has 8 or 16 lines");
+  static const unsigned int VECTORS = Lines / 4;
+
+public:
+  explicit FdnReverb(const FdnParameters& params) : params(params) {}
+
+  void prepare(unsigned int channels, unsigned int sampleRate, unsigned int) override
+  {
+    static const unsigned int lengths48k[16] = {
+      1031, 1327, 1523, 1753, 1973, 2179, 2417, 2633, 2843, 3083, 3307, 3517, 3727, 3947, 4153, 4391
+    };
+
+    this->channels = channels;
+    auto longest = 0u;
+    for (auto l = 0u; l < Lines; l++) {
+      lengths[l] = std::max(1u, static_cast<unsigned int>(lengths48k[l] * params.size * sampleRate / 48000.f));
+      longest = std::max(longest, lengths[l]);
+    }
+    frames = 1;
+    while (frames <= longest)
+      frames *= 2;
+    auto memory = static_cast<float*>(alignedAlloc(sizeof(float) * frames * Lines, SIMD_ALIGNMENT));
+    if (!memory) throw std::bad_alloc();
+    std::fill(memory, memory + frames * Lines, 0.f);
+    delay.reset(memory);
+    write = 0;
+
+    // the feedback gains give each line the same decay rate, including the
+    // normalization of the Hadamard matrix.
+    for (auto l = 0u; l < Lines; l++) {
+      feedback[l] = std::pow(10.f, -3.f * lengths[l] / (params.decay * sampleRate)) / std::sqrt(float(Lines));
+      input[l] = (l & 1 ? -1.f : 1.f) / std::sqrt(float(Lines));
+      taps[0][l] = (l & 2 ? -1.f : 1.f) / std::sqrt(float(Lines));
+      taps[1][l] = (l & 4 ? -1.f : 1.f) / std::sqrt(float(Lines));
+      state[l] = 0.f;
+    }
+    damping = 1.f - std::min(std::max(params.damping, 0.f), 0.99f);
+    decayFrames = longest + static_cast<unsigned int>(1.5f * params.decay * sampleRate);
+    cleared = true;
+  }
+
+  void process(float* const* samples, unsigned int count) override
+  {
+    const auto mask = frames - 1;
+    const auto scale = 1.f / channels;
+    auto memory = delay.get();
+
+    // the block may live on a heap which only aligns to 8 bytes, so the
+    // network is kept in float arrays and loaded into vectors for the call.
+    __m128 feedback[VECTORS], input[VECTORS], taps[2][VECTORS], state[VECTORS];
+    for (auto i = 0u; i < VECTORS; i++) {
+      feedback[i] = _mm_loadu_ps(this->feedback + i * 4);
+      input[i] = _mm_loadu_ps(this->input + i * 4);
+      taps[0][i] = _mm_loadu_ps(this->taps[0] + i * 4);
+      taps[1][i] = _mm_loadu_ps(this->taps[1] + i * 4);
+      state[i] = _mm_loadu_ps(this->state + i * 4);
+    }
+    const auto damping = _mm_set1_ps(this->damping);
+    for (auto t = 0u; t < count; t++) {
+      // gather the outputs of the lines and damp them.
+      alignas(16) float outputs[Lines];
+      for (auto l = 0u; l < Lines; l++)
+        outputs[l] = memory[((write - lengths[l]) & mask) * Lines + l];
+      __m128 v[VECTORS];
+      for (auto i = 0u; i < VECTORS; i++) {
+        v[i] = _mm_add_ps(state[i], _mm_mul_ps(damping, _mm_sub_ps(_mm_load_ps(outputs + i * 4), state[i])));
+        state[i] = v[i];
+      }
+
+      // tap the lines into the output channels.
+      auto x = 0.f;
+      for (auto c = 0u; c < channels; c++) {
+        auto acc = _mm_setzero_ps();
+        for (auto i = 0u; i < VECTORS; i++)
+          acc = _mm_add_ps(acc, _mm_mul_ps(v[i], taps[c & 1][i]));
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, acc);
+        auto wet = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        x += samples[c][t];
+        samples[c][t] = params.dry * samples[c][t] + params.wet * wet;
+      }
+
+      // mix the lines, apply the decay and feed the input back in.
+      hadamard(v);
+      auto in = _mm_set1_ps(x * scale);
+      auto row = memory + (write & mask) * Lines;
+      for (auto i = 0u; i < VECTORS; i++)
+        _mm_store_ps(row + i * 4, _mm_add_ps(_mm_mul_ps(v[i], feedback[i]), _mm_mul_ps(in, input[i])));
+      write++;
+    }
+    for (auto i = 0u; i < VECTORS; i++)
+      _mm_storeu_ps(this->state + i * 4, state[i]);
+    cleared = false;
+  }
+
+  // the network never fully decays, so the tail ends at -90 dB and the rest of
+  // the decay is cleared once the block gets skipped.
+  unsigned int tail() const override { return decayFrames; }
+
+  void skip(unsigned int) override
+  {
+    if (cleared) return;
+    std::fill(delay.get(), delay.get() + frames * Lines, 0.f);
+    std::fill(state, state + Lines, 0.f);
+    cleared = true;
+  }
+
+private:
+  // an unnormalized fast Walsh-Hadamard transform over the lines.
+  static void hadamard(__m128* v)
+  {
+    for (auto half = VECTORS / 2; half >= 1; half /= 2) {
+      for (auto i = 0u; i < VECTORS; i += half * 2) {
+        for (auto j = i; j < i + half; j++) {
+          auto a = v[j], b = v[j + half];
+          v[j] = _mm_add_ps(a, b);
+          v[j + half] = _mm_sub_ps(a, b);
+        }
+      }
+    }
+    const auto odd = _mm_set_ps(-1.f, 1.f, -1.f, 1.f);
+    const auto high = _mm_set_ps(-1.f, -1.f, 1.f, 1.f);
+    for (auto i = 0u; i < VECTORS; i++) {
+      auto y = _mm_add_ps(_mm_shuffle_ps(v[i], v[i], _MM_SHUFFLE(2, 3, 0, 1)), _mm_mul_ps(v[i], odd));
+      v[i] = _mm_add_ps(_mm_shuffle_ps(y, y, _MM_SHUFFLE(1, 0, 3, 2)), _mm_mul_ps(y, high));
+    }
+  }
+
+  FdnParameters                       params;
+  unsigned int                        channels = 0;
+  unsigned int                        lengths[Lines] = {};
+  unsigned int                        frames = 0;
+  unsigned int                        write = 0;
+  unsigned int                        decayFrames = 0;
+  bool                                cleared = true;
+  std::unique_ptr<float, AlignedFree> delay;
+  float                               feedback[Lines] = {};
+  float                               input[Lines] = {};
+  float                               taps[2][Lines] = {};
+  float                               state[Lines] = {};
+  float                               damping = 0.f;
+};
+
+// ============================================================================
+// DSP - Metering
+// The meter is a pass-through block which measures the per-channel peak and RMS
+// levels of each processed block with the SIMD reductions, and optionally the
+// spectrum of the channel average over the latest fftSize samples. A real FFT
+// is computed with a half-size complex FFT, where the even and odd samples are
+// packed into the real and the imaginary parts, and then split into the real
+// spectrum. The Hann window is normalized so a full scale sine reads as 1.0.
+//
+// The readings are published through a triple buffer once per processing pass,
+// so the game thread can read the latest levels whenever it wants to.
+//
+// The spectrum is opt-in per meter (an fftSize of 0 turns it off), as it costs
+// far more than the levels. Metering all the 21 buses of the offline benchmark
+// takes about 0.17% of the 10ms quantum with the levels only, but 1.5-1.9% with
+// a 1024-point spectrum on every bus, so the sandbox only analyses the master.
+// ============================================================================
+const unsigned int METER_MAX_CHANNELS = 8;
+const unsigned int METER_MAX_BINS = 1024;
+
+struct MeterReading
+{
+  uint64_t     pass;
+  unsigned int channels;
+  unsigned int bins;
+  float        peak[METER_MAX_CHANNELS];
+  float        rms[METER_MAX_CHANNELS];
+  float        spectrum[METER_MAX_BINS]; // linear magnitudes of bins [0, fftSize / 2).
+};
+
+class Meter : public DspBlock
+{
+public:
+  explicit Meter(unsigned int fftSize = 0) : fftSize(fftSize)
+  {
+    assert(fftSize == 0 || (fftSize >= 8 && fftSize / 2 <= METER_MAX_BINS && (fftSize & (fftSize - 1)) == 0));
+  }
+
+  void prepare(unsigned int channels, unsigned int, unsigned int maxFrames) override
+  {
+    assert(channels <= METER_MAX_CHANNELS);
+    this->channels = channels;
+    passes = 0;
+    if (fftSize == 0) return;
+
+    const auto pi = 3.14159265358979323846;
+    fft.reset(new Fft(fftSize / 2));
+    history.assign(fftSize, 0.f);
+    window.resize(fftSize);
+    auto sum = 0.0;
+    for (auto i = 0u; i < fftSize; i++) {
+      window[i] = float(0.5 - 0.5 * std::cos(2.0 * pi * i / fftSize));
+      sum += window[i];
+    }
+    for (auto& w : window)
+      w = float(w * 2.0 / sum);
+    re.resize(fftSize / 2);
+    im.resize(fftSize / 2);
+    splitRe.resize(fftSize / 2);
+    splitIm.resize(fftSize / 2);
+    for (auto k = 0u; k < fftSize / 2; k++) {
+      splitRe[k] = float(std::cos(-2.0 * pi * k / fftSize));
+      splitIm[k] = float(std::sin(-2.0 * pi * k / fftSize));
+    }
+    mono.resize(maxFrames);
+  }
+
+  void process(float* const* samples, unsigned int frames) override
+  {
+    auto& reading = readings.back();
+    reading.pass = ++passes;
+    reading.channels = channels;
+    for (auto c = 0u; c < channels; c++) {
+      reading.peak[c] = peakAbs(samples[c], frames);
+      reading.rms[c] = frames ? float(std::sqrt(sumOfSquares(samples[c], frames) / frames)) : 0.f;
+    }
+    reading.bins = 0;
+    if (fftSize > 0 && frames > 0)
+      analyze(samples, frames, reading);
+    readings.publish();
+  }
+
+  // the spectrum is computed from the latest fftSize samples.
+  unsigned int tail() const override { return fftSize; }
+
+  void skip(unsigned int) override
+  {
+    auto& reading = readings.back();
+    reading.pass = ++passes;
+    reading.channels = channels;
+    std::fill(reading.peak, reading.peak + channels, 0.f);
+    std::fill(reading.rms, reading.rms + channels, 0.f);
+    reading.bins = fftSize / 2;
+    std::fill(reading.spectrum, reading.spectrum + reading.bins, 0.f);
+    readings.publish();
+  }
+
+  // take the latest published reading (on the reading thread).
+  const MeterReading& read()
+  {
+    readings.update();
+    return readings.front();
+  }
+
+private:
+  void analyze(float* const* samples, unsigned int frames, MeterReading& reading)
+  {
+    // append the channel average to the end of the history.
+    const auto scale = _mm_set1_ps(1.f / channels);
+    auto i = 0u;
+    for (; i + 4 <= frames; i += 4) {
+      auto sum = _mm_setzero_ps();
+      for (auto c = 0u; c < channels; c++)
+        sum = _mm_add_ps(sum, _mm_loadu_ps(samples[c] + i));
+      _mm_storeu_ps(mono.data() + i, _mm_mul_ps(sum, scale));
+    }
+    for (; i < frames; i++) {
+      auto sum = 0.f;
+      for (auto c = 0u; c < channels; c++)
+        sum += samples[c][i];
+      mono[i] = sum / channels;
+    }
+    if (frames >= fftSize) {
+      std::copy(mono.data() + frames - fftSize, mono.data() + frames, history.data());
+    } else {
+      std::copy(history.data() + frames, history.data() + fftSize, history.data());
+      std::copy(mono.data(), mono.data() + frames, history.data() + fftSize - frames);
+    }
+
+    // window the history and pack it into a half-size complex transform.
+    const auto half = fftSize / 2;
+    for (auto k = 0u; k < half; k += 4) {
+      auto x0 = _mm_mul_ps(_mm_loadu_ps(history.data() + 2 * k), _mm_loadu_ps(window.data() + 2 * k));
+      auto x1 = _mm_mul_ps(_mm_loadu_ps(history.data() + 2 * k + 4), _mm_loadu_ps(window.data() + 2 * k + 4));
+      _mm_storeu_ps(re.data() + k, _mm_shuffle_ps(x0, x1, _MM_SHUFFLE(2, 0, 2, 0)));
+      _mm_storeu_ps(im.data() + k, _mm_shuffle_ps(x0, x1, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    fft->transform(re.data(), im.data(), false);
+
+    // split the packed spectrum into the spectrum of the real signal, where the
+    // mirrored bins [half - k - 3, half - k] are loaded and reversed.
+    reading.bins = half;
+    reading.spectrum[0] = std::abs(re[0] + im[0]) * 0.5f;
+    for (auto k = 1u; k < 4; k++)
+      reading.spectrum[k] = splitBin(k);
+    const auto halves = _mm_set1_ps(0.5f);
+    for (auto k = 4u; k < half; k += 4) {
+      auto ar = _mm_loadu_ps(re.data() + k), ai = _mm_loadu_ps(im.data() + k);
+      auto br = _mm_loadu_ps(re.data() + half - k - 3), bi = _mm_loadu_ps(im.data() + half - k - 3);
+      br = _mm_shuffle_ps(br, br, _MM_SHUFFLE(0, 1, 2, 3));
+      bi = _mm_shuffle_ps(bi, bi, _MM_SHUFFLE(0, 1, 2, 3));
+      auto evenRe = _mm_mul_ps(halves, _mm_add_ps(ar, br)), evenIm = _mm_mul_ps(halves, _mm_sub_ps(ai, bi));
+      auto oddRe = _mm_mul_ps(halves, _mm_add_ps(ai, bi)), oddIm = _mm_mul_ps(halves, _mm_sub_ps(br, ar));
+      auto wr = _mm_loadu_ps(splitRe.data() + k), wi = _mm_loadu_ps(splitIm.data() + k);
+      auto xRe = _mm_add_ps(evenRe, _mm_sub_ps(_mm_mul_ps(wr, oddRe), _mm_mul_ps(wi, oddIm)));
+      auto xIm = _mm_add_ps(evenIm, _mm_add_ps(_mm_mul_ps(wr, oddIm), _mm_mul_ps(wi, oddRe)));
+      _mm_storeu_ps(reading.spectrum + k, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(xRe, xRe), _mm_mul_ps(xIm, xIm))));
+    }
+  }
+
+  float splitBin(unsigned int k) const
+  {
+    const auto half = fftSize / 2;
+    auto evenRe = 0.5f * (re[k] + re[half - k]), evenIm = 0.5f * (im[k] - im[half - k]);
+    auto oddRe = 0.5f * (im[k] + im[half - k]), oddIm = -0.5f * (re[k] - re[half - k]);
+    auto xRe = evenRe + splitRe[k] * oddRe - splitIm[k] * oddIm;
+    auto xIm = evenIm + splitRe[k] * oddIm + splitIm[k] * oddRe;
+    return std::sqrt(xRe * xRe + xIm * xIm);
+  }
+
+  unsigned int               fftSize;
+  unsigned int               channels = 0;
+  uint64_t                   passes = 0;
+  std::unique_ptr<Fft>       fft;
+  std::vector<float>         history;
+  std::vector<float>         window;
+  std::vector<float>         mono;
+  std::vector<float>         re;
+  std::vector<float>         im;
+  std::vector<float>         splitRe;
+  std::vector<float>         splitIm;
+  TripleBuffer<MeterReading> readings;
+};
@@ -106,34 +106,106 @@
 // IXAPO interface. XAPOFX can be used for some common mechanisms to create
 // new effect instances.
 // ============================================================================
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <comdef.h>
+#include <crtdbg.h>
+#include <dbghelp.h>
 #include <vector>
 #include <wrl.h>
 
+// portable parts of the sandbox
+#include "bank.h"
+#include "benchmark.h"
+#include "dsp.h"
+#include "memory.h"
+#include "mixer.h"
+#include "test.h"
+#include "trace.h"
+
 // XAudio2
 #include <xaudio2.h>
+#include <xapobase.h>
 
 // Windows Media Foundation
 #include <mfapi.h>
 #include <mfidl.h>
 #include <mfreadwrite.h>
+#include <mferror.h>
 
 #pragma comment(lib, "xaudio2.lib")
+#pragma comment(lib, "xapobase.lib")
 #pragma comment(lib, "mfreadwrite.lib")
 #pragma comment(lib, "mfplat.lib")
 #pragma comment(lib, "mfuuid.lib")
+#pragma comment(lib, "dbghelp.lib")
 
 using namespace Microsoft::WRL;
 
 // ============================================================================
 
+// A handle to the samples of a file. Handles can only be moved, so that the
+// samples of a file are never duplicated or referenced by two files by accident.
+class SampleData
+{
+public:
+  SampleData() = default;
+  SampleData(BYTE* bytes, size_t length) : bytes(bytes), length(length) {}
+
+  SampleData(SampleData&& other) noexcept : bytes(other.bytes), length(other.length)
+  {
+    other.bytes = nullptr;
+    other.length = 0;
+  }
+
+  SampleData& operator=(SampleData&& other) noexcept
+  {
+    bytes = other.bytes;
+    length = other.length;
+    other.bytes = nullptr;
+    other.length = 0;
+    return *this;
+  }
+
+  SampleData(const SampleData&) = delete;
+  SampleData& operator=(const SampleData&) = delete;
+
+  BYTE* data() const { return bytes; }
+  size_t size() const { return length; }
+  bool empty() const { return length == 0; }
+
+private:
+  BYTE*  bytes = nullptr;
+  size_t length = 0;
+};
+
+// A decoded audio file. The format block is stored inline and the samples are
+// placed into the sample arena of the bank, which owns the memory of them. The
+// file is a move-only type, so it can't be copied with its samples by accident.
 struct AudioFile
 {
-  std::vector<BYTE> data;
-  WAVEFORMATEX*     format;
-  unsigned int      formatlength;
+  SampleData           data;
+  WAVEFORMATEXTENSIBLE formatBlock;
+  unsigned int         formatlength;
+  Loudness             loudness;
+  unsigned int         offset; // number of trimmed leading silence frames.
+
+  const WAVEFORMATEX* format() const { return &formatBlock.Format; }
 };
 
 // ============================================================================
@@ -146,6 +218,331 @@ inline void throwOnFail(HRESULT hr)
   if (FAILED(hr)) throw _com_error(hr);
 }
 
+// ============================================================================
+// Debug - Audio Thread Allocations
+// Debug builds install a CRT allocation hook that flags every heap allocation,
+// reallocation and release made while a thread is processing audio. The stack
+// of the offending call is captured into a preallocated record, as the hook is
+// not allowed to allocate, and the symbols are resolved when reported later.
+// ============================================================================
+const unsigned int ALLOCATION_MAX_RECORDS = 64;
+const unsigned int ALLOCATION_MAX_FRAMES = 16;
+
+struct AllocationRecord
+{
+  int    type;
+  size_t size;
+  USHORT frames;
+  void*  stack[ALLOCATION_MAX_FRAMES];
+};
+
+static AllocationRecord allocationRecords[ALLOCATION_MAX_RECORDS];
+static std::atomic<unsigned int> allocationCount{0};
+
+#ifdef _DEBUG
+int allocationHook(int type, void*, size_t size, int blockType, long, const unsigned char*, int)
+{
+  // the CRT blocks are allocated by the runtime itself (e.g. for iostreams).
+  if (!audioThread() || blockType == _CRT_BLOCK)
+    return TRUE;
+
+  auto index = allocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (index < ALLOCATION_MAX_RECORDS) {
+    auto& record = allocationRecords[index];
+    record.type = type;
+    record.size = size;
+    record.frames = CaptureStackBackTrace(1, ALLOCATION_MAX_FRAMES, record.stack, nullptr);
+  }
+  return TRUE;
+}
+#endif
+
+void startAllocationTracking()
+{
+#ifdef _DEBUG
+  _CrtSetAllocHook(allocationHook);
+#endif
+}
+
+// prints the recorded audio thread allocations and returns their count.
+unsigned int reportAllocations()
+{
+  static const char* const types[] = { "", "alloc", "realloc", "free" };
+  auto count = allocationCount.load(std::memory_order_acquire);
+  if (count == 0)
+    return 0;
+
+  auto process = GetCurrentProcess();
+  SymInitialize(process, nullptr, TRUE);
+  std::cerr << count << " heap operations on the audio thread" << std::endl;
+  for (auto i = 0u; i < std::min(count, ALLOCATION_MAX_RECORDS); i++) {
+    auto& record = allocationRecords[i];
+    std::cerr << "  " << types[record.type & 3] << " " << record.size << " bytes" << std::endl;
+    for (auto f = 0u; f < record.frames; f++) {
+      char buffer[sizeof(SYMBOL_INFO) + MAX_SYM_NAME] = {};
+      auto symbol = reinterpret_cast<SYMBOL_INFO*>(buffer);
+      symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+      symbol->MaxNameLen = MAX_SYM_NAME;
+      DWORD64 displacement = 0;
+      auto address = reinterpret_cast<DWORD64>(record.stack[f]);
+      if (SymFromAddr(process, address, &displacement, symbol))
+        std::cerr << "    " << symbol->Name << "+0x" << std::hex << displacement << std::dec << std::endl;
+      else
+        std::cerr << "    0x" << std::hex << address << std::dec << std::endl;
+    }
+  }
+  SymCleanup(process);
+  return count;
+}
+
+// ============================================================================
+// DSP - Sample Conversion
+// XAudio2 accepts both integer and floating point PCM, but all of our own signal
+// processing is done with 32-bit floats. These helpers convert the interleaved
+// bytes of an audio file into a planar float buffer for the portable code.
+// ============================================================================
+inline WORD formatTag(const WAVEFORMATEX& format)
+{
+  // extensible formats store the actual format tag into the sub-format GUID.
+  if (format.wFormatTag == WAVE_FORMAT_EXTENSIBLE) {
+    auto& extensible = reinterpret_cast<const WAVEFORMATEXTENSIBLE&>(format);
+    return static_cast<WORD>(extensible.SubFormat.Data1);
+  }
+  return format.wFormatTag;
+}
+
+// check that the samples are either 16-bit integers or 32-bit floats.
+inline HRESULT validateFormat(const WAVEFORMATEX& format)
+{
+  auto tag = formatTag(format);
+  if (tag == WAVE_FORMAT_IEEE_FLOAT && format.wBitsPerSample == 32)
+    return S_OK;
+  if (tag == WAVE_FORMAT_PCM && format.wBitsPerSample == 16)
+    return S_OK;
+  return MF_E_INVALIDMEDIATYPE;
+}
+
+PlanarBuffer toPlanar(const AudioFile& file)
+{
+  const auto& format = *file.format();
+  const auto channels = format.nChannels;
+  const auto frames = static_cast<unsigned int>(file.data.size() / format.nBlockAlign);
+
+  // deinterleave the samples into channel planes.
+  throwOnFail(validateFormat(format));
+  PlanarBuffer planes(channels, frames);
+  if (formatTag(format) == WAVE_FORMAT_IEEE_FLOAT) {
+    deinterleave(reinterpret_cast<const float*>(file.data.data()), planes, frames);
+  } else {
+    auto samples = reinterpret_cast<const int16_t*>(file.data.data());
+    for (auto c = 0u; c < channels; c++) {
+      auto plane = planes.channel(c);
+      for (auto i = 0u; i < frames; i++)
+        plane[i] = samples[i * channels + c] * (1.f / 32768.f);
+    }
+  }
+  return planes;
+}
+
+Loudness analyseLoudness(const AudioFile& file)
+{
+  auto planes = toPlanar(file);
+  return analyseLoudness(planes, file.format()->nSamplesPerSec);
+}
+
+// create a convolution reverb with an impulse response loaded like any file.
+std::unique_ptr<ConvolutionReverb> createConvolution(const AudioFile& impulse, const ConvolutionParameters& params)
+{
+  return std::make_unique<ConvolutionReverb>(toPlanar(impulse), impulse.format()->nSamplesPerSec,
+                                             impulse.offset, params);
+}
+
+// ============================================================================
+// DSP - Silence Trimming
+// Many sound effects contain a lot of leading and trailing silence, which both
+// wastes memory and keeps voices active while they are just mixing zeros. This
+// pass removes all frames from the both ends of the file whose samples are all
+// below the given threshold (in dBFS). A file that is silent all the way
+// through keeps its first frame, so it can still be played like any other file.
+// Trimming only narrows the view to the samples; the loader then compacts the
+// audible samples and returns the trimmed memory back to the sample arena.
+//
+// Played files start right at their first audible frame, so trimming moves the
+// onset of a sound earlier by the leading silence. This is on purpose, as the
+// silence would only delay the sound from the event that triggered it. The
+// amount of frames trimmed from the beginning is still stored as an offset for
+// the cases where the timing matters: a convolution reverb uses it as the
+// pre-delay of its impulse response.
+// ============================================================================
+const float SILENCE_THRESHOLD = -60.f; // dBFS
+
+template <typename T>
+inline bool isSilentFrame(const BYTE* frame, unsigned int channels, T threshold)
+{
+  auto samples = reinterpret_cast<const T*>(frame);
+  for (auto c = 0u; c < channels; c++)
+    if (samples[c] > threshold || samples[c] < -threshold)
+      return false;
+  return true;
+}
+
+void trimSilence(AudioFile& file, float threshold)
+{
+  const auto& format = *file.format();
+  throwOnFail(validateFormat(format));
+  const auto align = format.nBlockAlign;
+  const auto frames = file.data.size() / align;
+  const auto level = std::pow(10.f, threshold / 20.f);
+  const auto isFloat = formatTag(format) == WAVE_FORMAT_IEEE_FLOAT;
+  auto silent = [&](size_t frame) {
+    auto data = file.data.data() + frame * align;
+    if (isFloat)
+      return isSilentFrame<float>(data, format.nChannels, level);
+    return isSilentFrame<int16_t>(data, format.nChannels, int16_t(level * 32767.f));
+  };
+
+  // search for the first and the last audible frames.
+  auto first = size_t(0);
+  while (first < frames && silent(first))
+    first++;
+  auto last = frames;
+  while (last > first && silent(last - 1))
+    last--;
+  if (first == last && frames > 0) {
+    first = 0;
+    last = 1;
+  }
+
+  // narrow the sample data to the audible frames.
+  file.data = { file.data.data() + first * align, (last - first) * align };
+  file.offset = static_cast<unsigned int>(first);
+}
+
+// ============================================================================
+// XAPO - DSP Block Wrapper
+// This XAPO makes it possible to use any of our DSP blocks within XAudio2 voice
+// effect chains. XAudio2 always passes interleaved 32-bit float buffers to the
+// effects, so the buffer is deinterleaved for the block and interleaved back.
+//
+// XAudio2 may mark the input buffer as silent in which case the contents of it
+// are undefined. Blocks with internal state (like delay lines) must still get
+// processed to flush their state, so the buffer is cleared before processing.
+// Once the input has been silent for the tail of the block, the block is
+// skipped and the output is marked silent, so the downstream voices can skip
+// their processing too.
+// ============================================================================
+class __declspec(uuid("{6A1D3E4B-2F6C-4B8E-9C1A-7D5E3F2B8A10}")) DspBlockXAPO : public CXAPOBase
+{
+public:
+  explicit DspBlockXAPO(std::unique_ptr<DspBlock> block)
+    : CXAPOBase(&registration), block(std::move(block))
+  {
+  }
+
+  STDMETHOD(LockForProcess)(UINT32 inputCount,
+                            const XAPO_LOCKFORPROCESS_BUFFER_PARAMETERS* inputs,
+                            UINT32 outputCount,
+                            const XAPO_LOCKFORPROCESS_BUFFER_PARAMETERS* outputs) override
+  {
+    assert(inputCount == 1 && outputCount == 1);
+    channels = inputs[0].pFormat->nChannels;
+    planes = PlanarBuffer(channels, inputs[0].MaxFrameCount);
+    block->prepare(channels, inputs[0].pFormat->nSamplesPerSec, inputs[0].MaxFrameCount);
+    tail = block->tail();
+    silentFrames = 0;
+    return CXAPOBase::LockForProcess(inputCount, inputs, outputCount, outputs);
+  }
+
+  STDMETHOD_(void, Process)(UINT32 inputCount,
+                            const XAPO_PROCESS_BUFFER_PARAMETERS* inputs,
+                            UINT32 outputCount,
+                            XAPO_PROCESS_BUFFER_PARAMETERS* outputs,
+                            BOOL enabled) override
+  {
+    assert(inputCount == 1 && outputCount == 1);
+    auto samples = static_cast<float*>(inputs[0].pBuffer);
+    auto frames = inputs[0].ValidFrameCount;
+    auto silent = inputs[0].BufferFlags == XAPO_BUFFER_SILENT;
+    auto silentBefore = silentFrames;
+    silentFrames = silent ? addFrames(silentFrames, frames) : 0;
+    if (enabled && silent && tail != DSP_TAIL_INFINITE && silentBefore >= tail) {
+      block->skip(frames);
+      outputs[0].BufferFlags = XAPO_BUFFER_SILENT;
+    } else if (enabled) {
+      if (silent)
+        std::fill(samples, samples + frames * channels, 0.f);
+      deinterleave(samples, planes, frames);
+      block->process(planes.data(), frames);
+      interleave(planes, samples, frames);
+      outputs[0].BufferFlags = XAPO_BUFFER_VALID;
+    } else {
+      outputs[0].BufferFlags = inputs[0].BufferFlags;
+    }
+    outputs[0].ValidFrameCount = frames;
+  }
+
+private:
+  static XAPO_REGISTRATION_PROPERTIES registration;
+
+  std::unique_ptr<DspBlock> block;
+  unsigned int              channels = 0;
+  unsigned int              tail = DSP_TAIL_INFINITE;
+  unsigned int              silentFrames = 0;
+  PlanarBuffer              planes;
+};
+
+XAPO_REGISTRATION_PROPERTIES DspBlockXAPO::registration = {
+  __uuidof(DspBlockXAPO),
+  L"DSP Block",
+  L"xa2-sandbox",
+  1, 0,
+  XAPO_FLAG_CHANNELS_MUST_MATCH
+  | XAPO_FLAG_FRAMERATE_MUST_MATCH
+  | XAPO_FLAG_BITSPERSAMPLE_MUST_MATCH
+  | XAPO_FLAG_BUFFERCOUNT_MUST_MATCH
+  | XAPO_FLAG_INPLACE_SUPPORTED
+  | XAPO_FLAG_INPLACE_REQUIRED,
+  1, 1, 1, 1
+};
+
+// create a new XAPO which can be placed into a XAUDIO2_EFFECT_DESCRIPTOR.
+inline ComPtr<IUnknown> createXAPO(std::unique_ptr<DspBlock> block)
+{
+  ComPtr<IUnknown> xapo;
+  xapo.Attach(new DspBlockXAPO(std::move(block)));
+  return xapo;
+}
+
+// ============================================================================
+// XAudio2 - Engine Callback
+// The engine callback is invoked by the XAudio2 processing thread at the start
+// and at the end of each audio processing pass. We use it to record the passes
+// into the timeline trace, so the audio thread can be seen next to the others.
+// ============================================================================
+class EngineCallback : public IXAudio2EngineCallback
+{
+public:
+  STDMETHOD_(void, OnProcessingPassStart)() override
+  {
+    audioThread() = true;
+    passBegin = traceEnabled.load(std::memory_order_relaxed) ? traceTimestamp() : 0;
+  }
+
+  STDMETHOD_(void, OnProcessingPassEnd)() override
+  {
+    if (passBegin != 0)
+      traceEvent("engine pass", passBegin, traceTimestamp());
+    audioThread() = false;
+  }
+
+  STDMETHOD_(void, OnCriticalError)(HRESULT) override
+  {
+  }
+
+private:
+  int64_t passBegin = 0;
+};
+
 // ============================================================================
 // XAudio2 - Initialization
 // The heart of the engine is the IXAudio2 interface. It is used to enumerate
@@ -155,20 +552,37 @@ inline void throwOnFail(HRESULT hr)
 // has flags and processor definition to provide further customisation.
 //
 // Note that a single process can create multiple XAudio2 instances, where each
-// will operate in own thread. Only debugging settings will be shared.
+// will operate in own thread. Only debugging settings will be shared. When the
+// engine is sharded, each instance gets pinned on a processor of its own.
 // ============================================================================
-ComPtr<IXAudio2> initXAudio2()
+const unsigned int ENGINE_MAX_SHARDS = 8;
+
+ComPtr<IXAudio2> initXAudio2(unsigned int shard = 0, unsigned int shardCount = 1)
 {
+  assert(shard < shardCount && shardCount <= ENGINE_MAX_SHARDS);
+  TraceScope trace("initXAudio2");
+
   // initialize COM.
   throwOnFail(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
 
+  // pin the sharded engines on separate processors.
+  XAUDIO2_PROCESSOR processor = XAUDIO2_DEFAULT_PROCESSOR;
+  if (shardCount > 1) {
+    auto cores = std::max(1u, std::min(32u, std::thread::hardware_concurrency()));
+    processor = static_cast<XAUDIO2_PROCESSOR>(Processor1) << (shard % cores);
+  }
+
   // create a new instance of the XAudio2 engine.
   ComPtr<IXAudio2> xaudio2;
   throwOnFail(XAudio2Create(
     &xaudio2,
     0,
-    XAUDIO2_DEFAULT_PROCESSOR
+    processor
   ));
+
+  // register to receive the audio processing pass events.
+  static EngineCallback engineCallbacks[ENGINE_MAX_SHARDS];
+  throwOnFail(xaudio2->RegisterForCallbacks(&engineCallbacks[shard]));
   return xaudio2;
 }
 
@@ -184,11 +598,20 @@ ComPtr<IXAudio2> initXAudio2()
 //   DeviceId..........Identifier that receives the output audio.
 //   EffectChain.......A pointer to XAUDIO2_EFFECT_CHAIN. 
 //   StreamCategory....The audio stream category to be used.
+//
+// The mastering voice gets an effect chain with a compressor and a lookahead
+// limiter, which keep the dense mixes from clipping at the device. The chain is
+// set after the creation, as the channel count is autodetected by XAudio2. The
+// chain ends with a meter whose readings are available through the meter arg.
 // ============================================================================
-IXAudio2MasteringVoice* createMasteringVoice(ComPtr<IXAudio2> xaudio2)
+const unsigned int MASTER_METER_FFT = 1024;
+
+IXAudio2MasteringVoice* createMasteringVoice(ComPtr<IXAudio2> xaudio2, Meter** meter = nullptr)
 {
   assert(xaudio2);
 
+  TraceScope trace("createMasteringVoice");
+
   // create a new mastering voice for the target XAudio2 engine.
   IXAudio2MasteringVoice* masteringVoice = nullptr;
   throwOnFail(xaudio2->CreateMasteringVoice(
@@ -197,12 +620,304 @@ IXAudio2MasteringVoice* createMasteringVoice(ComPtr<IXAudio2> xaudio2)
     XAUDIO2_DEFAULT_SAMPLERATE, // autodetect
     0,
     nullptr,                    // autodetect
-    nullptr,                    // no effects
+    nullptr,                    // the effects are set below
     AudioCategory_GameEffects
   ));
+
+  // build the master bus effect chain for the autodetected channel count.
+  XAUDIO2_VOICE_DETAILS details = {};
+  masteringVoice->GetVoiceDetails(&details);
+  auto compressor = createXAPO(std::make_unique<Dynamics>(MASTER_COMPRESSOR));
+  auto limiter = createXAPO(std::make_unique<Dynamics>(MASTER_LIMITER));
+  std::unique_ptr<Meter> masterMeter(new Meter(MASTER_METER_FFT));
+  if (meter)
+    *meter = masterMeter.get();
+  auto metering = createXAPO(std::move(masterMeter));
+  XAUDIO2_EFFECT_DESCRIPTOR effects[] = {
+    { compressor.Get(), TRUE, details.InputChannels },
+    { limiter.Get(), TRUE, details.InputChannels },
+    { metering.Get(), TRUE, details.InputChannels }
+  };
+  XAUDIO2_EFFECT_CHAIN chain = { 3, effects };
+  throwOnFail(masteringVoice->SetEffectChain(&chain));
   return masteringVoice;
 }
 
+// ============================================================================
+// Memory - Sample Arena
+// The sample data of all the files in a sound bank is placed into a single
+// arena instead of a separate heap allocation for each file. This avoids the
+// heap fragmentation when banks are loaded and released over and over again.
+//
+// The arena reserves a contiguous range of virtual address space up front and
+// commits physical memory only as the data gets appended. This way files can
+// be decoded straight into the arena without knowing their sizes in advance,
+// and the data never moves. Each file starts at a 64-byte boundary to allow
+// aligned SIMD loads, and the whole bank is released with a single operation.
+//
+// The reserve is sized by the caller (e.g. from the stream durations of a bank)
+// to keep the address space of 32-bit processes free for the other banks. As
+// the data never moves, the arena can't grow past its reserve, so an append
+// that doesn't fit throws a std::length_error and the caller may try again
+// with a larger arena.
+// ============================================================================
+const size_t SAMPLE_ARENA_COMMIT = 1024 * 1024;
+
+class SampleArena
+{
+public:
+  explicit SampleArena(size_t reserve)
+    : reserved((std::max<size_t>(reserve, 1) + SAMPLE_ARENA_COMMIT - 1) / SAMPLE_ARENA_COMMIT * SAMPLE_ARENA_COMMIT)
+  {
+    base = static_cast<BYTE*>(VirtualAlloc(nullptr, reserved, MEM_RESERVE, PAGE_READWRITE));
+    if (!base) throw std::bad_alloc();
+  }
+
+  SampleArena(SampleArena&& other)
+    : reserved(other.reserved), base(other.base), committed(other.committed), used(other.used)
+  {
+    other.base = nullptr;
+  }
+
+  ~SampleArena()
+  {
+    if (base) VirtualFree(base, 0, MEM_RELEASE);
+  }
+
+  SampleArena(const SampleArena&) = delete;
+  SampleArena& operator=(const SampleArena&) = delete;
+
+  BYTE* data() const { return base; }
+  size_t size() const { return used; }
+  size_t capacity() const { return reserved; }
+
+  // move to the next aligned offset where the next allocation can begin.
+  size_t align()
+  {
+    used = (used + SIMD_ALIGNMENT - 1) / SIMD_ALIGNMENT * SIMD_ALIGNMENT;
+    return used;
+  }
+
+  void append(const BYTE* bytes, size_t count)
+  {
+    commit(used + count);
+    std::memcpy(base + used, bytes, count);
+    used += count;
+  }
+
+  // release the memory from the end of the arena (e.g. trimmed samples).
+  void truncate(size_t size)
+  {
+    assert(size <= used);
+    used = size;
+  }
+
+private:
+  void commit(size_t size)
+  {
+    if (size <= committed) return;
+    if (size > reserved) throw std::length_error("the sample arena is full");
+    auto target = std::min((size + SAMPLE_ARENA_COMMIT - 1) / SAMPLE_ARENA_COMMIT * SAMPLE_ARENA_COMMIT, reserved);
+    if (!VirtualAlloc(base + committed, target - committed, MEM_COMMIT, PAGE_READWRITE))
+      throw std::bad_alloc();
+    committed = target;
+  }
+
+  size_t reserved;
+  BYTE*  base;
+  size_t committed = 0;
+  size_t used = 0;
+};
+
+// ============================================================================
+// XAudio2 - Asynchronous Startup
+// Creating the engine and the mastering voice (i.e. opening the audio device)
+// takes a noticeable time, as do the WMF decoder setup and the decoding of the
+// initial assets. These don't depend on each other, so the engine is started
+// in a background thread while the main thread is decoding, and the startup is
+// joined only when the engine is needed to create the first voice.
+// ============================================================================
+struct AudioEngine
+{
+  ComPtr<IXAudio2>        xaudio2;
+  IXAudio2MasteringVoice* masteringVoice;
+  Meter*                  masterMeter;    // owned by the mastering voice.
+};
+
+std::future<AudioEngine> startAudioEngine(unsigned int shard = 0, unsigned int shardCount = 1)
+{
+  return std::async(std::launch::async, [shard, shardCount] {
+    AudioEngine engine;
+    engine.xaudio2 = initXAudio2(shard, shardCount);
+    engine.masteringVoice = createMasteringVoice(engine.xaudio2, &engine.masterMeter);
+    return engine;
+  });
+}
+
+// ============================================================================
+// XAudio2 - Ring Streaming
+// Streams the blocks of a sample ring into a source voice. The callback runs on
+// the audio thread, which makes it the single consumer of the ring: the newly
+// committed blocks are submitted at the start of each voice processing pass in
+// place (without copying) and they're released back to the producer after the
+// voice has finished with them. The ring capacity must fit the voice queue.
+// The optional preroll holds the playback back until that many blocks are
+// ready, whenever the voice queue is empty (see RingQueue).
+// ============================================================================
+class RingStream : public IXAudio2VoiceCallback
+{
+public:
+  explicit RingStream(SampleRing& ring, size_t preroll = 0) : queue(ring, preroll)
+  {
+    assert(ring.capacity() <= XAUDIO2_MAX_QUEUED_BUFFERS);
+  }
+
+  void attach(IXAudio2SourceVoice* target)
+  {
+    voice.store(target, std::memory_order_release);
+  }
+
+  STDMETHOD_(void, OnVoiceProcessingPassStart)(UINT32) override
+  {
+    auto target = voice.load(std::memory_order_acquire);
+    if (!target)
+      return;
+    queue.pump([target](SampleView view) {
+      XAUDIO2_BUFFER buffer = {};
+      buffer.AudioBytes = static_cast<UINT32>(view.size);
+      buffer.pAudioData = view.data;
+      TraceScope trace("SubmitSourceBuffer");
+      target->SubmitSourceBuffer(&buffer);
+    });
+  }
+
+  STDMETHOD_(void, OnBufferEnd)(void*) override
+  {
+    queue.release();
+  }
+
+  STDMETHOD_(void, OnVoiceProcessingPassEnd)() override {}
+  STDMETHOD_(void, OnStreamEnd)() override {}
+  STDMETHOD_(void, OnBufferStart)(void*) override {}
+  STDMETHOD_(void, OnLoopEnd)(void*) override {}
+  STDMETHOD_(void, OnVoiceError)(void*, HRESULT) override {}
+
+private:
+  RingQueue                         queue;
+  std::atomic<IXAudio2SourceVoice*> voice{ nullptr };
+};
+
+// create a new source voice which plays the blocks of the given ring stream.
+IXAudio2SourceVoice* createVoice(ComPtr<IXAudio2> xa2, const WAVEFORMATEX& format, RingStream& stream)
+{
+  assert(xa2);
+  TraceScope trace("createVoice");
+
+  IXAudio2SourceVoice* sourceVoice = nullptr;
+  throwOnFail(xa2->CreateSourceVoice(&sourceVoice, &format, 0, XAUDIO2_DEFAULT_FREQ_RATIO, &stream));
+  stream.attach(sourceVoice);
+  return sourceVoice;
+}
+
+// ============================================================================
+// XAudio2 - Sharded Engine
+// A single XAudio2 instance processes the whole graph in its one audio thread.
+// Heavy scenes can instead be partitioned across several instances, which are
+// started in parallel and pinned on separate processors. The voices are dealt
+// to the shards in turns.
+//
+// The first shard is also the merge stage. The mastering voices of the other
+// shards end in a tap effect (see ShardTap), which captures their output into
+// a sample ring and passes silence on to the device. XAudio2 only processes
+// the graphs that end in a mastering voice, so each shard keeps a device
+// stream of its own even though only the first one is audible. The first shard
+// streams the rings into its own mastering voice, so all the shards are summed
+// before the single master compressor and limiter, which keeps the merged
+// output at the ceiling.
+//
+// The engines run on their own clocks, so the merge voices preroll a couple of
+// blocks before they start playing and whenever a shard has fallen behind.
+// This adds the preroll and a quantum of latency to the voices of the other
+// shards. The engine is destroyed in order: the merge voices stop reading the
+// rings first, then the taps stop writing into them with the mastering voices.
+// ============================================================================
+const unsigned int SHARD_RING_BLOCKS = 8;
+const unsigned int SHARD_PREROLL_BLOCKS = 2;
+
+struct ShardedEngine
+{
+  // the rings are declared first to outlive the engines that use them.
+  std::vector<std::unique_ptr<SampleRing>> rings;
+  std::vector<std::unique_ptr<RingStream>> streams;
+  std::vector<AudioEngine>                 shards;
+  std::vector<IXAudio2SourceVoice*>        merges; // voices of the first shard playing the rings.
+  unsigned int                             next = 0;
+
+  // select the shard that receives the next voice.
+  AudioEngine& nextShard() { return shards[next++ % shards.size()]; }
+};
+
+// route the other shards through rings into the mastering voice of the first.
+void mergeShards(ShardedEngine& engine)
+{
+  auto& merge = engine.shards.front();
+  XAUDIO2_VOICE_DETAILS details = {};
+  merge.masteringVoice->GetVoiceDetails(&details);
+
+  WAVEFORMATEX format = {};
+  format.wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
+  format.nChannels = static_cast<WORD>(details.InputChannels);
+  format.nSamplesPerSec = details.InputSampleRate;
+  format.wBitsPerSample = 32;
+  format.nBlockAlign = format.nChannels * sizeof(float);
+  format.nAvgBytesPerSec = format.nSamplesPerSec * format.nBlockAlign;
+
+  // blocks fit two 10ms passes of the mastering voice.
+  const auto blockBytes = size_t(format.nAvgBytesPerSec) / 50;
+  engine.merges.reserve(engine.shards.size());
+  for (auto i = 1u; i < engine.shards.size(); i++) {
+    engine.rings.emplace_back(new SampleRing(blockBytes, SHARD_RING_BLOCKS));
+    engine.streams.emplace_back(new RingStream(*engine.rings.back(), SHARD_PREROLL_BLOCKS));
+
+    // replace the master dynamics of the shard with the tap.
+    auto tap = createXAPO(std::make_unique<ShardTap>(*engine.rings.back()));
+    XAUDIO2_EFFECT_DESCRIPTOR effects[] = { { tap.Get(), TRUE, details.InputChannels } };
+    XAUDIO2_EFFECT_CHAIN chain = { 1, effects };
+    throwOnFail(engine.shards[i].masteringVoice->SetEffectChain(&chain));
+    engine.shards[i].masterMeter = nullptr;
+
+    engine.merges.push_back(createVoice(merge.xaudio2, format, *engine.streams.back()));
+    throwOnFail(engine.merges.back()->Start());
+  }
+}
+
+// destroy the merge voices and the mastering voices of the shards. the source
+// voices played on the shards must have been destroyed before.
+void destroyShardedEngine(ShardedEngine& engine)
+{
+  for (auto voice : engine.merges)
+    voice->DestroyVoice();
+  engine.merges.clear();
+  for (auto i = engine.shards.size(); i-- > 0;)
+    engine.shards[i].masteringVoice->DestroyVoice();
+  engine.shards.clear();
+}
+
+std::future<ShardedEngine> startShardedEngine(unsigned int shardCount)
+{
+  return std::async(std::launch::async, [shardCount] {
+    std::vector<std::future<AudioEngine>> startups;
+    for (auto i = 0u; i < shardCount; i++)
+      startups.push_back(startAudioEngine(i, shardCount));
+
+    ShardedEngine engine;
+    for (auto& startup : startups)
+      engine.shards.push_back(startup.get());
+    mergeShards(engine);
+    return engine;
+  });
+}
+
 // ============================================================================
 // WMF - Initialize
 // The use of Windows Media Foundation (WMF) is not necessary, but it provides
@@ -212,6 +927,11 @@ IXAudio2MasteringVoice* createMasteringVoice(ComPtr<IXAudio2> xaudio2)
 // ============================================================================
 ComPtr<IMFAttributes> initWMF()
 {
+  TraceScope trace("initWMF");
+
+  // initialize COM for the thread which uses WMF.
+  throwOnFail(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+
   // initialize the core Window Media Foundation.
   throwOnFail(MFStartup(MF_VERSION));
 
@@ -225,16 +945,19 @@ ComPtr<IMFAttributes> initWMF()
 }
 
 // ============================================================================
-// WMF - Load a file into a XAudio2 supported format.
+// WMF - Open a source reader.
 // Windows Media Foundation contains useful functions to load audio data from a
 // file. We may also use a decoder functionality to load and decode audio that
 // is compressed e.g. as mp3 or such.
+//
+// Configures a source reader to decode the first audio stream of the file into
+// a XAudio2 supported format and stores that format into the given file.
 // ============================================================================
-AudioFile loadFile(const std::wstring& file, ComPtr<IMFAttributes> config)
+ComPtr<IMFSourceReader> openReader(const std::wstring& path, ComPtr<IMFAttributes> config, AudioFile& file)
 {
   // construct a source reader.
   ComPtr<IMFSourceReader> reader;
-  throwOnFail(MFCreateSourceReaderFromURL(file.c_str(), config.Get(), &reader));
+  throwOnFail(MFCreateSourceReaderFromURL(path.c_str(), config.Get(), &reader));
 
   // select only the very first audio stream.
   auto streamIndex = MF_SOURCE_READER_FIRST_AUDIO_STREAM;
@@ -250,74 +973,454 @@ AudioFile loadFile(const std::wstring& file, ComPtr<IMFAttributes> config)
   throwOnFail(mediaType->GetGUID(MF_MT_MAJOR_TYPE, &majorType));
   assert(majorType == MFMediaType_Audio);
 
-  // configure WMF to decompress the audio file if it is compressed.
+  // configure WMF to decode the audio into either 16-bit integer or 32-bit
+  // float samples, which are the only formats our sample conversion reads.
+  // Compressed audio is decoded into 16-bit samples and uncompressed samples
+  // of any other depth (e.g. 8-bit or 24-bit) are converted into floats.
   GUID subType = {};
+  UINT32 bits = 0;
   throwOnFail(mediaType->GetGUID(MF_MT_SUBTYPE, &subType));
-  if (subType != MFAudioFormat_Float && subType != MFAudioFormat_PCM) {
+  mediaType->GetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, &bits);
+  const auto isFloat = subType == MFAudioFormat_Float;
+  const auto isPcm = subType == MFAudioFormat_PCM;
+  if (!(isFloat && bits == 32) && !(isPcm && bits == 16)) {
     ComPtr<IMFMediaType> target;
     throwOnFail(MFCreateMediaType(&target));
     throwOnFail(target->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio));
-    throwOnFail(target->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM));
+    throwOnFail(target->SetGUID(MF_MT_SUBTYPE, isFloat || isPcm ? MFAudioFormat_Float : MFAudioFormat_PCM));
+    throwOnFail(target->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, isFloat || isPcm ? 32 : 16));
     throwOnFail(reader->SetCurrentMediaType(streamIndex, nullptr, target.Get()));
   }
 
-  // process the data and load it into a XAudio2 buffer.
-  AudioFile audioFile = {};
+  // resolve the wave format of the decoded data.
   ComPtr<IMFMediaType> audioType;
+  WAVEFORMATEX* format = nullptr;
+  UINT32 formatLength = 0;
   throwOnFail(reader->GetCurrentMediaType(streamIndex, &audioType));
   throwOnFail(MFCreateWaveFormatExFromMFMediaType(
     audioType.Get(),
-    &audioFile.format,
-    &audioFile.formatlength
+    &format,
+    &formatLength
   ));
 
+  // copy the format block into the file and release the one allocated by WMF.
+  assert(formatLength <= sizeof(file.formatBlock));
+  std::memcpy(&file.formatBlock, format, std::min<size_t>(formatLength, sizeof(file.formatBlock)));
+  file.formatlength = formatLength;
+  CoTaskMemFree(format);
+  throwOnFail(validateFormat(*file.format()));
+
   // ensure that the target stream is being selected.
   throwOnFail(reader->SetStreamSelection(streamIndex, true));
 
-  // read samples from the source file into a byte vector. 
+  return reader;
+}
+
+// get the decoded size of the stream from its duration (or 0 if it's unknown).
+size_t streamBytes(IMFSourceReader* reader, const WAVEFORMATEX& format)
+{
+  auto bytes = size_t(0);
+  PROPVARIANT duration;
+  PropVariantInit(&duration);
+  if (SUCCEEDED(reader->GetPresentationAttribute(MF_SOURCE_READER_MEDIASOURCE, MF_PD_DURATION, &duration))) {
+    bytes = static_cast<size_t>(duration.uhVal.QuadPart * format.nAvgBytesPerSec / 10000000);
+    PropVariantClear(&duration);
+  }
+  return bytes;
+}
+
+// ============================================================================
+// WMF - Read a sample.
+// Reads the next decoded sample from the source reader and passes its data to
+// the consumer. Returns false when the end of the stream has been reached.
+// ============================================================================
+template <typename Consumer>
+bool readSample(IMFSourceReader* reader, Consumer consume)
+{
+  DWORD flags = 0;
   ComPtr<IMFSample> sample;
+  {
+    TraceScope trace("ReadSample");
+    throwOnFail(reader->ReadSample(MF_SOURCE_READER_FIRST_AUDIO_STREAM, 0, nullptr, &flags, nullptr, &sample));
+  }
+
+  // check whether data type is changed or EOF has been reached.
+  if (flags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED)
+    return false;
+  if (flags & MF_SOURCE_READERF_ENDOFSTREAM)
+    return false;
+  if (!sample)
+    return true;
+
+  // get data from the audio sample via a buffer.
   ComPtr<IMFMediaBuffer> buffer;
   BYTE* audioData = nullptr;
   DWORD audioDataSize = 0;
-  while (true) {
-    DWORD flags = 0;
-    throwOnFail(reader->ReadSample(streamIndex, 0, nullptr, &flags, nullptr, &sample));
-
-    // check whether data type is changed or EOF has been reached.
-    if (flags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED)
-      break;
-    if (flags & MF_SOURCE_READERF_ENDOFSTREAM)
-      break;
-
-    // get data from the audio sample via a buffer.
-    throwOnFail(sample->ConvertToContiguousBuffer(&buffer));
-    throwOnFail(buffer->Lock(&audioData, nullptr, &audioDataSize));
-    for (auto i = 0u; i < audioDataSize; i++) {
-      audioFile.data.push_back(audioData[i]);
-    }
-    throwOnFail(buffer->Unlock());
-  }
+  throwOnFail(sample->ConvertToContiguousBuffer(&buffer));
+  throwOnFail(buffer->Lock(&audioData, nullptr, &audioDataSize));
+  consume(audioData, audioDataSize);
+  throwOnFail(buffer->Unlock());
+  return true;
+}
+
+// ============================================================================
+// WMF - Load a file into a XAudio2 supported format.
+// The samples are decoded straight into the given sample arena. Leading and
+// trailing silence below the silence threshold (dBFS) is trimmed away from the
+// decoded data and the loudness of the result gets analysed.
+// ============================================================================
+AudioFile loadFile(ComPtr<IMFSourceReader> reader, AudioFile audioFile, SampleArena& arena,
+                   float silenceThreshold = SILENCE_THRESHOLD)
+{
+  TraceScope trace("loadFile");
+
+  // read samples from the source file into the sample arena.
+  auto start = arena.align();
+  while (readSample(reader.Get(), [&](const BYTE* data, DWORD size) { arena.append(data, size); }))
+    ;
+  audioFile.data = { arena.data() + start, arena.size() - start };
+  if (audioFile.data.size() < audioFile.format()->nBlockAlign)
+    throwOnFail(MF_E_INVALID_FILE_FORMAT);
+
+  // remove the leading and trailing silence from the decoded audio data.
+  trimSilence(audioFile, silenceThreshold);
+
+  // move the audible samples to the start and release the trimmed memory.
+  std::memmove(arena.data() + start, audioFile.data.data(), audioFile.data.size());
+  audioFile.data = { arena.data() + start, audioFile.data.size() };
+  arena.truncate(start + audioFile.data.size());
+
+  // analyse the loudness of the decoded audio data.
+  audioFile.loudness = analyseLoudness(audioFile);
 
   // return the decoded and XAudio2 ready audio package.
   return audioFile;
 }
 
+// construct a source reader that decodes into a XAudio2 supported format and
+// load the file with it.
+AudioFile loadFile(const std::wstring& file, ComPtr<IMFAttributes> config, SampleArena& arena,
+                   float silenceThreshold = SILENCE_THRESHOLD)
+{
+  AudioFile audioFile = {};
+  auto reader = openReader(file, config, audioFile);
+  return loadFile(reader, std::move(audioFile), arena, silenceThreshold);
+}
+
+// ============================================================================
+// WMF - Load a sound bank.
+// A sound bank is a batch of files that are loaded and released together. All
+// the samples of the bank are placed into a single sample arena, so the whole
+// bank is released with a single operation when the bank is destroyed. The
+// files are indexed by the IDs of their names.
+//
+// All the files are opened before decoding, so the arena can be reserved from
+// the stream durations of the bank. If a stream doesn't report its duration or
+// decodes longer than reported, the arena overflows and the bank is loaded
+// again with twice the reserve. The failed attempt (its arena and readers) is
+// released before the next one, so the retries don't hold two arenas at once.
+// ============================================================================
+struct SoundBank
+{
+  SampleArena            arena;
+  std::vector<AudioFile> files;
+  SoundIndex             index;
+
+  // returns the file with the given sound ID or nullptr if it's not found.
+  const AudioFile* find(uint32_t id) const
+  {
+    auto file = index.find(id);
+    return file == SLOT_INVALID ? nullptr : &files[file];
+  }
+};
+
+SoundBank loadBank(const std::vector<std::wstring>& files, ComPtr<IMFAttributes> config)
+{
+  TraceScope trace("loadBank");
+
+  // index the files before decoding them, which rejects the duplicate IDs.
+  SoundIndex index;
+  std::vector<uint32_t> ids;
+  for (auto& file : files)
+    ids.push_back(soundId(file.c_str()));
+  index.build(ids);
+
+  for (auto reserve = size_t(0);;) {
+    // open the files and reserve the arena for the decoded streams, including
+    // the alignment padding and some headroom for the decoder delays.
+    std::vector<ComPtr<IMFSourceReader>> readers;
+    std::vector<AudioFile> headers(files.size());
+    auto estimate = size_t(0);
+    for (auto i = 0u; i < files.size(); i++) {
+      readers.push_back(openReader(files[i], config, headers[i]));
+      auto bytes = streamBytes(readers.back().Get(), *headers[i].format());
+      estimate += bytes + bytes / 16 + SIMD_ALIGNMENT + headers[i].format()->nAvgBytesPerSec / 10;
+    }
+
+    // decode the files into the arena, or retry with a larger one on overflow.
+    SoundBank bank = { SampleArena(std::max(reserve, estimate)) };
+    try {
+      for (auto i = 0u; i < files.size(); i++)
+        bank.files.push_back(loadFile(readers[i], std::move(headers[i]), bank.arena));
+    } catch (const std::length_error&) {
+      reserve = bank.arena.capacity() * 2;
+      continue;
+    }
+    bank.index = std::move(index);
+    return bank;
+  }
+}
+
+// ============================================================================
+// WMF - Decode-ahead loading.
+// Decodes only the first few hundred milliseconds of a file up front so that a
+// voice can start playing it immediately. The remainder is decoded by a worker
+// thread in chunks that are appended into the voice queue as they get ready,
+// which happens well before the decoded prefix runs out.
+//
+// The first remainder chunk is kept short to reach the queue early and the rest
+// are sized by the stream duration so that the whole file fits into the source
+// voice queue without waiting for the buffers to be played. If the duration is
+// missing or too short, the chunks that don't fit into the queue are submitted
+// by the worker as the queued buffers get played. Silence is not trimmed as the
+// end is unknown, and the loudness measured from the prefix is provisional: it
+// normalizes the voice without waiting for the rest of the file, which may be
+// louder or quieter than its first few hundred milliseconds.
+//
+// The worker never throws: a decoding failure ends the stream with the chunks
+// decoded before it, and the error is kept for the player to check the status.
+// The file must be cancelled before its voice gets destroyed, as the worker
+// submits into the voice until the file is cancelled.
+// ============================================================================
+const unsigned int DECODE_AHEAD_MS = 300;
+const unsigned int DECODE_CHUNK_MS = 250;
+const unsigned int DECODE_MAX_CHUNKS = XAUDIO2_MAX_QUEUED_BUFFERS / 2;
+const size_t DECODE_ARENA_RESERVE = 4 * SAMPLE_ARENA_COMMIT; // fits a prefix of 8 float channels at 192kHz.
+
+class DeferredFile
+{
+public:
+  DeferredFile(const std::wstring& path, ComPtr<IMFAttributes> config, SampleArena& arena,
+               unsigned int prefixMs = DECODE_AHEAD_MS)
+  {
+    TraceScope trace("loadDeferred");
+    auto reader = openReader(path, config, head);
+    const auto& format = *head.format();
+    const auto align = format.nBlockAlign;
+
+    // decode the prefix into the sample arena.
+    const size_t prefixBytes = size_t(format.nAvgBytesPerSec) * prefixMs / 1000;
+    auto start = arena.align();
+    auto more = true;
+    while (arena.size() - start < prefixBytes && more)
+      more = readSample(reader.Get(), [&](const BYTE* data, DWORD size) { arena.append(data, size); });
+    head.data = { arena.data() + start, arena.size() - start };
+    if (!more && head.data.size() < align)
+      throwOnFail(MF_E_INVALID_FILE_FORMAT);
+    head.loudness = analyseLoudness(head); // provisional, see above.
+
+    // size the remainder chunks with the stream duration.
+    size_t chunkBytes = size_t(format.nAvgBytesPerSec) * DECODE_CHUNK_MS / 1000;
+    auto total = streamBytes(reader.Get(), format);
+    if (total > head.data.size())
+      chunkBytes = std::max(chunkBytes, (total - head.data.size()) / DECODE_MAX_CHUNKS);
+    chunkBytes = std::max<size_t>(align, chunkBytes - chunkBytes % align);
+
+    // decode the remainder in the background.
+    finished = !more;
+    if (more)
+      worker = std::thread(&DeferredFile::decodeRemainder, this, reader, chunkBytes);
+  }
+
+  ~DeferredFile()
+  {
+    cancel();
+  }
+
+  DeferredFile(const DeferredFile&) = delete;
+  DeferredFile& operator=(const DeferredFile&) = delete;
+
+  // the decoded prefix, with the provisional loudness measured from it.
+  const AudioFile& prefix() const { return head; }
+
+  // returns the first failure of the background decoding (S_OK if none), after
+  // which the stream ends early.
+  HRESULT status() const { return failure.load(); }
+
+  // stops decoding and submitting the chunks and waits for the worker to exit.
+  void cancel()
+  {
+    cancelled = true;
+    if (worker.joinable())
+      worker.join();
+  }
+
+  // submits the prefix and the chunks decoded so far into the voice. the rest
+  // of the chunks are submitted by the worker as soon as they are decoded and
+  // there is room for them in the voice queue.
+  void submit(IXAudio2SourceVoice* target)
+  {
+    assert(target);
+    std::lock_guard<std::mutex> lock(mutex);
+    assert(!voice);
+
+    // the prefix may be empty when the decoder delays its first samples.
+    if (head.data.size() >= head.format()->nBlockAlign) {
+      XAUDIO2_BUFFER buffer = {};
+      buffer.AudioBytes = static_cast<UINT32>(head.data.size());
+      buffer.pAudioData = head.data.data();
+      buffer.Flags = finished && chunks.empty() ? XAUDIO2_END_OF_STREAM : 0;
+      throwOnFail(target->SubmitSourceBuffer(&buffer));
+      ended = buffer.Flags != 0;
+    }
+
+    voice = target;
+    throwOnFail(flush());
+  }
+
+private:
+  // submits the pending chunks into the voice while there is room in the voice
+  // queue and marks the end of the stream once all of them are submitted. the
+  // mutex must be held.
+  HRESULT flush()
+  {
+    XAUDIO2_VOICE_STATE state;
+    voice->GetState(&state, XAUDIO2_VOICE_NOSAMPLESPLAYED);
+    auto queued = state.BuffersQueued;
+    for (; submitted < chunks.size() && queued < XAUDIO2_MAX_QUEUED_BUFFERS; submitted++, queued++) {
+      XAUDIO2_BUFFER buffer = {};
+      buffer.AudioBytes = static_cast<UINT32>(chunks[submitted].size());
+      buffer.pAudioData = chunks[submitted].data();
+      buffer.Flags = finished && submitted + 1 == chunks.size() ? XAUDIO2_END_OF_STREAM : 0;
+      TraceScope trace("SubmitSourceBuffer");
+      auto hr = voice->SubmitSourceBuffer(&buffer);
+      if (FAILED(hr)) return hr;
+      ended = buffer.Flags != 0;
+    }
+
+    // mark the end of the stream when the last chunk was already submitted.
+    if (finished && !ended && submitted == chunks.size()) {
+      ended = true;
+      return voice->Discontinuity();
+    }
+    return S_OK;
+  }
+
+  // publishes a decoded chunk and submits it if the voice is already playing.
+  HRESULT publish(std::vector<BYTE>&& chunk, bool last)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!chunk.empty())
+      chunks.push_back(std::move(chunk));
+    finished = last;
+    return voice ? flush() : S_OK;
+  }
+
+  void decodeRemainder(ComPtr<IMFSourceReader> reader, size_t chunkBytes)
+  {
+    auto initialized = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    auto submitting = S_OK;
+    if (SUCCEEDED(initialized)) {
+      try {
+        // keep the first chunk within the prefix length to have it queued in time.
+        auto limit = std::min(chunkBytes, head.data.size());
+        std::vector<BYTE> chunk;
+        chunk.reserve(limit);
+        while (!cancelled && SUCCEEDED(submitting)) {
+          TraceScope trace("decodeChunk");
+          auto more = true;
+          while (chunk.size() < limit && more)
+            more = readSample(reader.Get(), [&](const BYTE* data, DWORD size) { chunk.insert(chunk.end(), data, data + size); });
+          submitting = publish(std::move(chunk), !more);
+          if (!more)
+            break;
+          limit = chunkBytes;
+          chunk = std::vector<BYTE>();
+          chunk.reserve(limit);
+        }
+      } catch (const _com_error& error) {
+        // the stream is ended below with the chunks decoded before the failure.
+        fail(error.Error());
+      } catch (...) {
+        fail(E_FAIL);
+      }
+      reader.Reset();
+      CoUninitialize();
+    } else {
+      fail(initialized);
+    }
+
+    // submit the chunks that didn't fit into the voice queue as it drains.
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      finished = true;
+    }
+    while (!cancelled && SUCCEEDED(submitting)) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (voice) {
+          submitting = flush();
+          if (ended) break;
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(DECODE_CHUNK_MS / 10));
+    }
+    if (FAILED(submitting))
+      fail(submitting);
+  }
+
+  // keeps the first failure, as the later ones are usually caused by it.
+  void fail(HRESULT error)
+  {
+    auto expected = S_OK;
+    failure.compare_exchange_strong(expected, error);
+  }
+
+  AudioFile                       head = {};
+  std::mutex                      mutex;
+  std::vector<std::vector<BYTE>>  chunks;
+  size_t                          submitted = 0;
+  bool                            finished = false;
+  bool                            ended = false; // a buffer marked the end of the stream.
+  IXAudio2SourceVoice*            voice = nullptr;
+  std::atomic<bool>               cancelled{false};
+  std::atomic<HRESULT>            failure{S_OK};
+  std::thread                     worker;
+};
+
 // ============================================================================
 // XAudio2 - Create a new source voice.
 // Source voices act as a containers of audio data that can be provided by the
 // application using the XAudio2 API.
 // ============================================================================
-IXAudio2SourceVoice* createVoice(ComPtr<IXAudio2> xa2, AudioFile& file)
+
+// destroys a voice that hasn't been handed over yet when its setup fails.
+struct DestroyVoice
+{
+  void operator()(IXAudio2Voice* voice) const { voice->DestroyVoice(); }
+};
+
+IXAudio2SourceVoice* createVoice(ComPtr<IXAudio2> xa2, const AudioFile& file)
 {
   assert(xa2);
-  assert(file.format);
+  TraceScope trace("createVoice");
 
   // create a new source voice with a desired sound format.
   IXAudio2SourceVoice* sourceVoice = nullptr;
-  throwOnFail(xa2->CreateSourceVoice(&sourceVoice, file.format));
+  throwOnFail(xa2->CreateSourceVoice(&sourceVoice, file.format()));
+  std::unique_ptr<IXAudio2SourceVoice, DestroyVoice> guard(sourceVoice);
+
+  // normalize the voice volume based on the analysed loudness.
+  throwOnFail(sourceVoice->SetVolume(normalizingGain(file.loudness)));
 
   // return the created source voice.
-  return sourceVoice;
+  return guard.release();
+}
+
+// sharded engines create each new voice on the next shard in turn.
+IXAudio2SourceVoice* createVoice(ShardedEngine& engine, const AudioFile& file)
+{
+  return createVoice(engine.nextShard().xaudio2, file);
 }
 
 // ============================================================================
@@ -325,45 +1428,643 @@ IXAudio2SourceVoice* createVoice(ComPtr<IXAudio2> xa2, AudioFile& file)
 // First fills the source voice buffer with the audio data from the read audio
 // file and then start playing the actual sound by sending it to audio queue.
 // ============================================================================
-void playVoice(IXAudio2SourceVoice* voice, AudioFile& file)
+void playVoice(IXAudio2SourceVoice* voice, const AudioFile& file)
 {
   assert(voice);
   assert(!file.data.empty());
 
   // fill a buffer descriptor with the file details.
   XAUDIO2_BUFFER buffer = {};
-  buffer.AudioBytes = file.data.size();
-  buffer.pAudioData = &file.data[0];
+  buffer.AudioBytes = static_cast<UINT32>(file.data.size());
+  buffer.pAudioData = file.data.data();
 
   // submit audio buffer into the source voice.
-  throwOnFail(voice->SubmitSourceBuffer(&buffer));
+  {
+    TraceScope trace("SubmitSourceBuffer");
+    throwOnFail(voice->SubmitSourceBuffer(&buffer));
+  }
 
   // it's time start playing the voice.
   voice->Start();
 }
 
+// decode-ahead files submit their prefix now and the remainder once decoded.
+void playVoice(IXAudio2SourceVoice* voice, DeferredFile& file)
+{
+  assert(voice);
+  {
+    TraceScope trace("SubmitSourceBuffer");
+    file.submit(voice);
+  }
+  voice->Start();
+}
+
 // ============================================================================
+// XAudio2 - Voice Allocator
+// Voices are limited both by the voice budget and by the resources available
+// to XAudio2. Instead of failing when a new voice can't be had, the allocator
+// steals the least valuable voice: finished voices go first, and the rest are
+// scored by their priority scaled by their gain (i.e. audibility) and reduced
+// with their age. Only running out of memory counts as running out of voices,
+// the other failures (e.g. an unsupported format) are thrown to the caller.
+//
+// A voice stolen for the budget is faded out with a linear volume ramp, which
+// is advanced by update once per game frame like the music crossfades, and it
+// is destroyed once the fade is over. Voices stolen for the memory of XAudio2
+// are destroyed right away, as the new voice can't be created before.
+//
+// The voice state is kept in parallel arrays, so the scoring is a single pass
+// over a few tightly packed arrays instead of a walk through voice objects.
+// The sounds are addressed with slot map handles, which become stale safely
+// when their voice gets stolen. The gain of a sound is the user gain applied
+// on top of the loudness normalization of its file, which is kept separately.
+// ============================================================================
+const unsigned int VOICE_BUDGET = 64;
+const unsigned int VOICE_STEAL_FADE_MS = 20;
+const float        VOICE_AGE_WEIGHT = 0.5f;
+
+// find the voice with the lowest score, where finished voices score below 0.
+size_t cheapestVoice(const float* priority, const float* gain, const float* started, const float* ends,
+                     size_t count, float now, float& score)
+{
+  auto cheapest = count;
+  score = std::numeric_limits<float>::max();
+  for (auto i = 0u; i < count; i++) {
+    auto value = now >= ends[i] ? -1.f : priority[i] * gain[i] / (1.f + (now - started[i]) * VOICE_AGE_WEIGHT);
+    if (value < score) {
+      score = value;
+      cheapest = i;
+    }
+  }
+  return cheapest;
+}
 
-int main()
+class VoiceAllocator
 {
+public:
+  VoiceAllocator(ComPtr<IXAudio2> xaudio2, unsigned int budget = VOICE_BUDGET)
+    : xaudio2(xaudio2), budget(budget), epoch(std::chrono::steady_clock::now())
+  {
+    // the arrays never reallocate, so a new voice is tracked without throwing.
+    voices.reserve(budget);
+    priorities.reserve(budget);
+    normalizations.reserve(budget);
+    gains.reserve(budget);
+    starts.reserve(budget);
+    ends.reserve(budget);
+  }
+
+  ~VoiceAllocator()
+  {
+    for (auto voice : voices)
+      voice->DestroyVoice();
+    for (auto& fade : fades)
+      fade.voice->DestroyVoice();
+  }
+
+  VoiceAllocator(const VoiceAllocator&) = delete;
+  VoiceAllocator& operator=(const VoiceAllocator&) = delete;
+
+  size_t size() const { return voices.size(); }
+
+  // play the file with a new voice. returns an invalid handle if all existing
+  // voices are more valuable than the new one.
+  SoundHandle play(const AudioFile& file, float priority)
+  {
+    TraceScope trace("allocateVoice");
+    auto now = seconds();
+    fadeOut(now);
+
+    // make room within the budget.
+    if (voices.size() >= budget && !steal(now, priority, true))
+      return INVALID_SOUND;
+
+    // steal without a fade when XAudio2 runs out of memory for the voice.
+    std::unique_ptr<IXAudio2SourceVoice, DestroyVoice> voice;
+    try {
+      voice.reset(createVoice(xaudio2, file));
+    } catch (const _com_error& error) {
+      if (error.Error() != E_OUTOFMEMORY || !steal(now, priority, false))
+        throw;
+      voice.reset(createVoice(xaudio2, file));
+    }
+    playVoice(voice.get(), file);
+
+    auto& format = *file.format();
+    auto duration = float(file.data.size() / format.nBlockAlign) / format.nSamplesPerSec;
+    auto handle = handles.insert();
+    voices.push_back(voice.release());
+    priorities.push_back(priority);
+    normalizations.push_back(normalizingGain(file.loudness));
+    gains.push_back(normalizations.back());
+    starts.push_back(now);
+    ends.push_back(now + duration);
+    return handle;
+  }
+
+  // returns the voice of the sound or nullptr if the sound has been stolen.
+  IXAudio2SourceVoice* voice(SoundHandle sound) const
+  {
+    auto index = handles.find(sound);
+    return index == SLOT_INVALID ? nullptr : voices[index];
+  }
+
+  // change the user gain of a sound, which also affects its audibility score.
+  bool setGain(SoundHandle sound, float gain)
+  {
+    auto index = handles.find(sound);
+    if (index == SLOT_INVALID)
+      return false;
+    gains[index] = gain * normalizations[index];
+    throwOnFail(voices[index]->SetVolume(gains[index]));
+    return true;
+  }
+
+  // stop the sound with a short fade and release its voice.
+  void stop(SoundHandle sound)
+  {
+    auto index = handles.find(sound);
+    if (index != SLOT_INVALID)
+      release(index, seconds(), true);
+  }
+
+  // advance the fades of the stolen voices. this should be called once per
+  // each game frame.
+  void update()
+  {
+    fadeOut(seconds());
+  }
+
+private:
+  struct Fade
+  {
+    IXAudio2SourceVoice* voice;
+    float                gain;
+    float                start;
+  };
+
+  float seconds() const
+  {
+    return std::chrono::duration<float>(std::chrono::steady_clock::now() - epoch).count();
+  }
+
+  // steal the cheapest voice unless it has a higher priority than the new one.
+  bool steal(float now, float priority, bool fade)
+  {
+    float score = 0.f;
+    auto index = cheapestVoice(priorities.data(), gains.data(), starts.data(), ends.data(),
+                               voices.size(), now, score);
+    if (index == voices.size() || (score >= 0.f && priorities[index] > priority))
+      return false;
+
+    // finished voices are silent already, so they can go right away.
+    release(static_cast<uint32_t>(index), now, fade && score >= 0.f);
+    return true;
+  }
+
+  void release(uint32_t index, float now, bool fade)
+  {
+    auto voice = voices[index];
+    if (fade) {
+      fades.push_back({ voice, gains[index], now });
+    } else {
+      voice->DestroyVoice();
+    }
+
+    // keep the arrays dense by moving the last voice into the freed slot.
+    handles.erase(index);
+    voices[index] = voices.back();
+    priorities[index] = priorities.back();
+    normalizations[index] = normalizations.back();
+    gains[index] = gains.back();
+    starts[index] = starts.back();
+    ends[index] = ends.back();
+    voices.pop_back();
+    priorities.pop_back();
+    normalizations.pop_back();
+    gains.pop_back();
+    starts.pop_back();
+    ends.pop_back();
+  }
+
+  // ramp the volumes of the stolen voices down and destroy the faded ones.
+  void fadeOut(float now)
+  {
+    const auto length = VOICE_STEAL_FADE_MS / 1000.f;
+    auto faded = std::remove_if(fades.begin(), fades.end(), [now, length](const Fade& fade) {
+      auto t = (now - fade.start) / length;
+      if (t < 1.f) {
+        fade.voice->SetVolume(fade.gain * (1.f - t));
+        return false;
+      }
+      fade.voice->DestroyVoice();
+      return true;
+    });
+    fades.erase(faded, fades.end());
+  }
+
+  ComPtr<IXAudio2>                      xaudio2;
+  unsigned int                          budget;
+  std::chrono::steady_clock::time_point epoch;
+  SlotMap                               handles;
+  std::vector<IXAudio2SourceVoice*>     voices;
+  std::vector<float>                    priorities;
+  std::vector<float>                    normalizations; // loudness normalization of the files.
+  std::vector<float>                    gains;          // user gain times the normalization.
+  std::vector<float>                    starts;
+  std::vector<float>                    ends;
+  std::vector<Fade>                     fades;
+};
+
+// ============================================================================
+// XAudio2 - Music Player
+// Music is streamed through a deck: a source voice that plays a sample ring,
+// which a decoder thread keeps filled with the tracks of the deck playlist. A
+// track that ends in the middle of a block is followed by the next track in
+// the same block, so the queued tracks are chained without any gaps. The next
+// track is opened as soon as the previous one starts decoding, and the decoder
+// only ever decodes a block at a time, so the cost of a transition is spread
+// over the playback instead of landing on a single frame.
+//
+// A crossfade starts the new track on a second deck and ramps the volumes of
+// the decks with an equal-power curve. Tracks chained on a deck must share the
+// wave format of the first track, as the deck voice is created with it.
+//
+// A track that fails to open, has a different format or fails in the middle
+// of decoding is logged and skipped, and the deck carries on with the next
+// track of the playlist, so a single bad file never silences the whole deck.
+// ============================================================================
+const unsigned int MUSIC_BLOCK_MS = 100;
+const unsigned int MUSIC_BLOCKS = 16;
+
+class MusicDeck
+{
+public:
+  MusicDeck(ComPtr<IXAudio2> xaudio2, ComPtr<IMFAttributes> config, const std::wstring& path, float volume)
+    : xaudio2(xaudio2), config(config), volume(volume)
+  {
+    playlist.push_back(path);
+    decoder = std::thread(&MusicDeck::decode, this);
+  }
+
+  ~MusicDeck()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    decoder.join();
+    if (voice)
+      voice->DestroyVoice();
+  }
+
+  MusicDeck(const MusicDeck&) = delete;
+  MusicDeck& operator=(const MusicDeck&) = delete;
+
+  // queue a track to be played right after the previous one ends.
+  void queue(const std::wstring& path)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      playlist.push_back(path);
+    }
+    wake.notify_all();
+  }
+
+  void setVolume(float target)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    volume = target;
+    if (voice)
+      voice->SetVolume(volume);
+  }
+
+private:
+  // log a track that can't be played, which is then skipped.
+  static void skipTrack(const std::wstring& path, HRESULT error)
+  {
+    std::wcerr << L"music track " << path << L" skipped (error 0x" << std::hex << error << std::dec << L")"
+               << std::endl;
+  }
+
+  // open a track with the deck format. throws if the format differs.
+  ComPtr<IMFSourceReader> open(const std::wstring& path)
+  {
+    TraceScope trace("openTrack");
+    AudioFile track = {};
+    auto reader = openReader(path, config, track);
+    if (format.formatlength == 0) {
+      std::memcpy(&format.formatBlock, &track.formatBlock, sizeof(track.formatBlock));
+      format.formatlength = track.formatlength;
+    } else if (track.formatlength != format.formatlength ||
+               std::memcmp(&format.formatBlock, &track.formatBlock, format.formatlength) != 0) {
+      throwOnFail(MF_E_INVALIDMEDIATYPE);
+    }
+    return reader;
+  }
+
+  // returns the next track that opens from the playlist or nullptr when the
+  // playlist runs out. the tracks that fail to open are skipped.
+  ComPtr<IMFSourceReader> openNext(bool wait, std::wstring& path)
+  {
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (wait)
+          wake.wait(lock, [this] { return stopping || !playlist.empty(); });
+        if (stopping || playlist.empty())
+          return nullptr;
+        path = playlist.front();
+        playlist.erase(playlist.begin());
+      }
+      try {
+        return open(path);
+      } catch (const _com_error& error) {
+        skipTrack(path, error.Error());
+      }
+    }
+  }
+
+  // create the ring and the voice once the format of the first track is known.
+  void startVoice()
+  {
+    auto& wave = *format.format();
+    blockBytes = size_t(wave.nAvgBytesPerSec) * MUSIC_BLOCK_MS / 1000;
+    blockBytes -= blockBytes % wave.nBlockAlign;
+    ring.reset(new SampleRing(blockBytes, MUSIC_BLOCKS));
+    stream.reset(new RingStream(*ring));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    voice = ::createVoice(xaudio2, wave, *stream);
+    throwOnFail(voice->SetVolume(volume));
+    throwOnFail(voice->Start());
+  }
+
+  void decode()
+  {
+    // the deck falls silent only if its voice can't be created or it runs out
+    // of memory, as the failures of the tracks are handled track by track.
+    auto initialized = false;
+    try {
+      throwOnFail(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+      initialized = true;
+      decodePlaylist();
+    } catch (const _com_error& error) {
+      std::cerr << "music deck stopped (error 0x" << std::hex << error.Error() << std::dec << ")" << std::endl;
+    } catch (const std::exception& error) {
+      std::cerr << "music deck stopped (" << error.what() << ")" << std::endl;
+    }
+    if (initialized)
+      CoUninitialize();
+  }
+
+  void decodePlaylist()
+  {
+    std::wstring currentPath, nextPath;
+    ComPtr<IMFSourceReader> current = openNext(true, currentPath);
+    if (current)
+      startVoice();
+
+    std::vector<BYTE> pending;
+    size_t consumed = 0;
+    ComPtr<IMFSourceReader> next;
+    while (current && !stopping) {
+      // open the next track well ahead of the transition.
+      if (!next)
+        next = openNext(false, nextPath);
+
+      // wait for the voice to release a block.
+      auto block = ring->acquire();
+      if (!block) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(MUSIC_BLOCK_MS / 4));
+        continue;
+      }
+
+      // fill the block and chain the next track right after the current one.
+      TraceScope trace("decodeBlock");
+      size_t size = 0;
+      while (size < blockBytes && current) {
+        if (consumed == pending.size()) {
+          pending.clear();
+          consumed = 0;
+          auto more = false;
+          try {
+            more = readSample(current.Get(), [&](const BYTE* data, DWORD bytes) {
+              pending.insert(pending.end(), data, data + bytes);
+            });
+          } catch (const _com_error& error) {
+            skipTrack(currentPath, error.Error());
+          }
+          if (!more) {
+            current = std::move(next);
+            currentPath = nextPath;
+            next = nullptr;
+          }
+          continue;
+        }
+        auto count = std::min(pending.size() - consumed, blockBytes - size);
+        std::memcpy(block + size, pending.data() + consumed, count);
+        consumed += count;
+        size += count;
+      }
+      if (size > 0)
+        ring->commit(size);
+
+      // idle until a new track is queued after the playlist has run out.
+      if (!current)
+        current = openNext(true, currentPath);
+    }
+  }
+
+  ComPtr<IXAudio2>            xaudio2;
+  ComPtr<IMFAttributes>       config;
+  AudioFile                   format = {};
+  size_t                      blockBytes = 0;
+  std::unique_ptr<SampleRing> ring;
+  std::unique_ptr<RingStream> stream;
+  IXAudio2SourceVoice*        voice = nullptr;
+  float                       volume;
+  std::mutex                  mutex;
+  std::condition_variable     wake;
+  std::vector<std::wstring>   playlist;
+  std::atomic<bool>           stopping{ false };
+  std::thread                 decoder;
+};
+
+class MusicPlayer
+{
+public:
+  MusicPlayer(ComPtr<IXAudio2> xaudio2, ComPtr<IMFAttributes> config)
+    : xaudio2(xaudio2), config(config)
+  {
+  }
+
+  // start playing the given track right away.
+  void play(const std::wstring& path)
+  {
+    fading.reset();
+    active.reset(new MusicDeck(xaudio2, config, path, 1.f));
+  }
+
+  // queue the given track to follow the current one without a gap.
+  void queue(const std::wstring& path)
+  {
+    if (active)
+      active->queue(path);
+    else
+      play(path);
+  }
+
+  // crossfade from the current track into the given one.
+  void crossfade(const std::wstring& path, float seconds)
+  {
+    fading = std::move(active);
+    active.reset(new MusicDeck(xaudio2, config, path, fading ? 0.f : 1.f));
+    fadeStart = std::chrono::steady_clock::now();
+    fadeLength = seconds;
+  }
+
+  // advance the crossfade. this should be called once per each game frame.
+  void update()
+  {
+    if (!fading)
+      return;
+
+    const auto halfPi = 1.57079632679489661923f;
+    auto elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - fadeStart).count();
+    auto t = fadeLength > 0.f ? std::min(elapsed / fadeLength, 1.f) : 1.f;
+    fading->setVolume(std::cos(t * halfPi));
+    active->setVolume(std::sin(t * halfPi));
+    if (t >= 1.f)
+      fading.reset();
+  }
+
+private:
+  ComPtr<IXAudio2>                      xaudio2;
+  ComPtr<IMFAttributes>                 config;
+  std::unique_ptr<MusicDeck>            active;
+  std::unique_ptr<MusicDeck>            fading;
+  std::chrono::steady_clock::time_point fadeStart;
+  float                                 fadeLength = 0.f;
+};
+
+// ============================================================================
+// Benchmark - Voice Scoring
+// Measures the single pass that selects the voice to be stolen.
+// ============================================================================
+void benchmarkVoiceScoring(unsigned int count)
+{
+  const auto iterations = 10000;
+  std::vector<float> priority(count), gain(count), started(count), ends(count);
+  fillNoise(gain.data(), count);
+  for (auto i = 0u; i < count; i++) {
+    priority[i] = float(i % 4);
+    gain[i] = std::fabs(gain[i]);
+    started[i] = float(i) / count;
+    ends[i] = 10.f + started[i];
+  }
+
+  volatile size_t selected = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (auto i = 0; i < iterations; i++) {
+    float score = 0.f;
+    selected = cheapestVoice(priority.data(), gain.data(), started.data(), ends.data(), count, 1.f + i * 1e-4f, score);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+
+  auto ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  std::cout << "voice scoring (" << count << " voices): " << ns << " ns/pass" << std::endl;
+}
+
+// ============================================================================
+// Benchmark - Run
+// Runs the portable benchmarks (see benchmark.cpp) and the ones which depend
+// on the XAudio2 parts of the sandbox when the application is started with the
+// --bench argument. The heap operations made on the audio thread are reported.
+// ============================================================================
+int runSandboxBenchmarks()
+{
+  startAllocationTracking();
+  benchmarkVoiceScoring(VOICE_BUDGET);
+  benchmarkVoiceScoring(1024);
+  runBenchmarks();
+  reportAllocations();
+  return 0;
+}
+
+// ============================================================================
+
+int main(int argc, char* argv[])
+{
+  if (argc > 1 && std::string(argv[1]) == "--bench")
+    return runSandboxBenchmarks();
+  if (argc > 1 && std::string(argv[1]) == "--test")
+    return runTests();
+
+  // record the timeline of the sandbox into a trace file.
+  startTracing();
+  startAllocationTracking();
+
+  // start XAudio2 in the background while the initial assets are decoded.
+  auto engineStartup = startAudioEngine();
+
   // initialize Windows Media Foundation.
   auto wmfReader = initWMF();
-  auto audioFile = loadFile(L"test.mp3", wmfReader);
+  SampleArena arena(DECODE_ARENA_RESERVE);
+  std::unique_ptr<DeferredFile> audioFile(new DeferredFile(L"test.mp3", wmfReader, arena));
 
-  // initialize XAudio2.
-  auto xaudio2 = initXAudio2();
-  auto masteringVoice = createMasteringVoice(xaudio2);
-  auto sourceVoice = createVoice(xaudio2, audioFile);
+  // wait for XAudio2 to be ready before creating the first voice.
+  auto engine = engineStartup.get();
+  auto xaudio2 = engine.xaudio2;
+  auto masteringVoice = engine.masteringVoice;
+  auto sourceVoice = createVoice(xaudio2, audioFile->prefix());
 
-  // play the loaded sounds.
-  playVoice(sourceVoice, audioFile);
+  // play the loaded sounds while the rest of them is still being decoded.
+  playVoice(sourceVoice, *audioFile);
 
-  Sleep(7000);
+  // print the master levels while the sound is playing.
+  for (auto i = 0; i < 14; i++) {
+    Sleep(500);
+    auto& levels = engine.masterMeter->read();
+    std::cout << "master";
+    for (auto c = 0u; c < levels.channels; c++)
+      std::cout << " " << 20.f * std::log10(levels.peak[c] + 1e-9f) << "/"
+                << 20.f * std::log10(levels.rms[c] + 1e-9f) << " dBFS";
+    std::cout << std::endl;
+  }
+  if (FAILED(audioFile->status()))
+    std::wcerr << L"test.mp3 ended early (error 0x" << std::hex << audioFile->status() << std::dec << L")"
+               << std::endl;
+
+  // stop decoding before the voice it submits into is destroyed, then remove
+  // the voices from the XAudio2 graph.
+  audioFile->cancel();
+  sourceVoice->DestroyVoice();
+  audioFile.reset();
 
-  // stop and and remove the mastering voice from the XAudio2 graph.
+  // play the file again from a sound bank through the voice allocator, which
+  // is updated once per game frame, and stop it with a fade after a while.
+  {
+    auto bank = loadBank({ L"test.mp3" }, wmfReader);
+    VoiceAllocator voices(xaudio2);
+    auto file = bank.find(soundId(L"test.mp3"));
+    assert(file);
+    auto sound = voices.play(*file, 1.f);
+    for (auto frame = 0; frame < 180; frame++) {
+      Sleep(16);
+      if (frame == 150)
+        voices.stop(sound);
+      voices.update();
+    }
+  }
   masteringVoice->DestroyVoice();
 
+  // write the recorded timeline events and the audio thread allocations.
+  writeTrace("trace.json");
+  reportAllocations();
+
   // shutdown Windows Media Foundation (WMF).
   MFShutdown();
   return 0;
-}
\ No newline at end of file
+}
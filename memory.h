@@ -0,0 +1,436 @@
+// ============================================================================
+// Memory - Aligned Allocations
+// SIMD code wants its data to start at a 64-byte boundary (a full cache line),
+// which the standard allocators don't guarantee. The aligned allocation of the
+// platform is wrapped here, so the portable code doesn't depend on the CRT.
+// ============================================================================
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+const unsigned int SIMD_ALIGNMENT = 64;
+const size_t       CACHE_LINE = 64;
+
+inline void* alignedAlloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+  return _aligned_malloc(size, alignment);
+#else
+  void* memory = nullptr;
+  return posix_memalign(&memory, alignment, size) == 0 ? memory : nullptr;
+#endif
+}
+
+inline void alignedFree(void* memory)
+{
+#ifdef _WIN32
+  _aligned_free(memory);
+#else
+  std::free(memory);
+#endif
+}
+
+struct AlignedFree
+{
+  void operator()(void* memory) const { alignedFree(memory); }
+};
+
+// ============================================================================
+// Memory - Audio Thread Marker
+// Threads mark themselves for the time they process audio, so that the debug
+// builds of the sandbox can flag the heap operations made on the audio thread.
+// ============================================================================
+inline bool& audioThread()
+{
+  thread_local bool processing = false;
+  return processing;
+}
+
+// marks the current thread as an audio thread for the lifetime of the scope.
+class AudioThreadScope
+{
+public:
+  AudioThreadScope() : previous(audioThread()) { audioThread() = true; }
+  ~AudioThreadScope() { audioThread() = previous; }
+
+private:
+  bool previous;
+};
+
+// ============================================================================
+// Memory - Real-Time Pool
+// The audio thread must not wait for locks, which also rules out the heap as it
+// is guarded by one. Objects created on the audio thread (e.g. buffer contexts,
+// command nodes and event records) are taken from a pool of fixed-size slots
+// that is allocated up front. The free slots form a lock-free stack, where the
+// head carries a tag that is bumped on each change to avoid the ABA problem.
+//
+// The pool is about a bounded cost rather than a lower average: an allocation
+// never waits for another thread or the system, whereas the average speed of
+// the pool against the heap depends on the allocator and the machine.
+// ============================================================================
+const size_t   POOL_ALIGNMENT = 16;
+const uint32_t POOL_EMPTY = 0xFFFFFFFF;
+
+class FixedPool
+{
+public:
+  FixedPool(size_t slotSize, uint32_t capacity)
+    : slotSize((slotSize + POOL_ALIGNMENT - 1) / POOL_ALIGNMENT * POOL_ALIGNMENT),
+      capacity(capacity),
+      storage(static_cast<uint8_t*>(alignedAlloc(this->slotSize * capacity, POOL_ALIGNMENT))),
+      next(new std::atomic<uint32_t>[capacity])
+  {
+    if (!storage) throw std::bad_alloc();
+    for (auto i = 0u; i < capacity; i++)
+      next[i].store(i + 1 < capacity ? i + 1 : POOL_EMPTY, std::memory_order_relaxed);
+    head.store(capacity > 0 ? 0 : POOL_EMPTY, std::memory_order_release);
+  }
+
+  ~FixedPool()
+  {
+    alignedFree(storage);
+  }
+
+  FixedPool(const FixedPool&) = delete;
+  FixedPool& operator=(const FixedPool&) = delete;
+
+  // returns a free slot or nullptr when the pool has been exhausted.
+  void* allocate()
+  {
+    auto top = head.load(std::memory_order_acquire);
+    while (true) {
+      auto index = static_cast<uint32_t>(top);
+      if (index == POOL_EMPTY)
+        return nullptr;
+      auto desired = nextTag(top) | next[index].load(std::memory_order_relaxed);
+      if (head.compare_exchange_weak(top, desired, std::memory_order_acquire, std::memory_order_acquire))
+        return storage + index * slotSize;
+    }
+  }
+
+  void deallocate(void* slot)
+  {
+    assert(slot >= storage && slot < storage + slotSize * capacity);
+    auto index = static_cast<uint32_t>((static_cast<uint8_t*>(slot) - storage) / slotSize);
+    auto top = head.load(std::memory_order_relaxed);
+    do {
+      next[index].store(static_cast<uint32_t>(top), std::memory_order_relaxed);
+    } while (!head.compare_exchange_weak(top, nextTag(top) | index, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+private:
+  static uint64_t nextTag(uint64_t top)
+  {
+    return ((top >> 32) + 1) << 32;
+  }
+
+  size_t                                 slotSize;
+  uint32_t                               capacity;
+  uint8_t*                               storage;
+  std::unique_ptr<std::atomic<uint32_t>[]> next;
+  std::atomic<uint64_t>                  head;
+};
+
+template <typename T>
+class ObjectPool
+{
+  static_assert(alignof(T) <= POOL_ALIGNMENT, "over-aligned pool object");
+
+public:
+  explicit ObjectPool(uint32_t capacity) : pool(sizeof(T), capacity) {}
+
+  template <typename... Args>
+  T* create(Args&&... args)
+  {
+    auto slot = pool.allocate();
+    return slot ? new (slot) T(std::forward<Args>(args)...) : nullptr;
+  }
+
+  void destroy(T* object)
+  {
+    object->~T();
+    pool.deallocate(object);
+  }
+
+private:
+  FixedPool pool;
+};
+
+// ============================================================================
+// Memory - Triple Buffer
+// Publishes the latest value of a structure from the audio thread to a reader
+// thread without locks or waiting. The writer fills the back slot and swaps it
+// with the middle slot, while the reader swaps the middle slot into the front
+// slot only when a new value has been published. Neither side ever touches the
+// slot owned by the other one, and values the reader didn't see are dropped.
+// ============================================================================
+const unsigned int TRIPLE_INDEX = 0x3;
+const unsigned int TRIPLE_FRESH = 0x4;
+
+template <typename T>
+class TripleBuffer
+{
+public:
+  // the slot to be filled by the writer.
+  T& back() { return slots[backIndex]; }
+
+  void publish()
+  {
+    auto previous = middle.exchange(backIndex | TRIPLE_FRESH, std::memory_order_acq_rel);
+    backIndex = previous & TRIPLE_INDEX;
+  }
+
+  // take the latest published value, returns false when there was none.
+  bool update()
+  {
+    if (!(middle.load(std::memory_order_relaxed) & TRIPLE_FRESH))
+      return false;
+    auto previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+    frontIndex = previous & TRIPLE_INDEX;
+    return true;
+  }
+
+  // the slot owned by the reader.
+  const T& front() const { return slots[frontIndex]; }
+
+private:
+  T                         slots[3] = {};
+  unsigned int              backIndex = 0;
+  unsigned int              frontIndex = 1;
+  std::atomic<unsigned int> middle{ 2 };
+};
+
+// ============================================================================
+// Memory - Sample Ring
+// A wait-free single-producer single-consumer ring of fixed-size sample blocks
+// that hands decoded, captured or rendered audio over to the audio thread. The
+// blocks are stored contiguously, so the consumer gets views into the storage
+// that can be given straight to SubmitSourceBuffer without copying.
+//
+// The indices are kept on separate cache lines together with a cached copy of
+// the index of the other side, so that the shared lines only move between the
+// cores when the ring appears to be full or empty.
+// ============================================================================
+struct SampleView
+{
+  const uint8_t* data;
+  size_t         size;
+};
+
+class SampleRing
+{
+public:
+  SampleRing(size_t blockSize, uint32_t blockCount)
+    : blockSize((blockSize + SIMD_ALIGNMENT - 1) / SIMD_ALIGNMENT * SIMD_ALIGNMENT),
+      mask(blockCount - 1),
+      storage(static_cast<uint8_t*>(alignedAlloc(this->blockSize * blockCount, SIMD_ALIGNMENT))),
+      sizes(new size_t[blockCount])
+  {
+    assert(blockCount > 0 && (blockCount & mask) == 0);
+    if (!storage) throw std::bad_alloc();
+  }
+
+  ~SampleRing()
+  {
+    alignedFree(storage);
+  }
+
+  SampleRing(const SampleRing&) = delete;
+  SampleRing& operator=(const SampleRing&) = delete;
+
+  size_t capacity() const { return mask + 1; }
+  size_t blockCapacity() const { return blockSize; }
+
+  // producer: returns the next free block or nullptr when the ring is full.
+  uint8_t* acquire()
+  {
+    auto write = producer.index.load(std::memory_order_relaxed);
+    if (write - producer.cached > mask) {
+      producer.cached = consumer.index.load(std::memory_order_acquire);
+      if (write - producer.cached > mask)
+        return nullptr;
+    }
+    return storage + (write & mask) * blockSize;
+  }
+
+  // producer: publishes the acquired block with the given amount of data.
+  void commit(size_t size)
+  {
+    assert(size <= blockSize);
+    auto write = producer.index.load(std::memory_order_relaxed);
+    sizes[write & mask] = size;
+    producer.index.store(write + 1, std::memory_order_release);
+  }
+
+  // consumer: returns the number of blocks that are ready to be read. the
+  // producer index is only read when fewer than the wanted blocks are known.
+  size_t readable(size_t wanted = 1)
+  {
+    auto read = consumer.index.load(std::memory_order_relaxed);
+    if (consumer.cached - read < wanted)
+      consumer.cached = producer.index.load(std::memory_order_acquire);
+    return consumer.cached - read;
+  }
+
+  // consumer: returns a view to a readable block (0 being the oldest one).
+  SampleView peek(size_t ahead = 0) const
+  {
+    auto index = (consumer.index.load(std::memory_order_relaxed) + ahead) & mask;
+    return { storage + index * blockSize, sizes[index] };
+  }
+
+  // consumer: hands the oldest blocks back to the producer.
+  void release(size_t count = 1)
+  {
+    auto read = consumer.index.load(std::memory_order_relaxed);
+    assert(count <= consumer.cached - read);
+    consumer.index.store(read + count, std::memory_order_release);
+  }
+
+private:
+  struct Cursor
+  {
+    char                padding[CACHE_LINE];
+    std::atomic<size_t> index{0};
+    size_t              cached = 0;
+  };
+
+  size_t                    blockSize;
+  size_t                    mask;
+  uint8_t*                  storage;
+  std::unique_ptr<size_t[]> sizes;
+  Cursor                    producer;
+  Cursor                    consumer;
+  char                      padding[CACHE_LINE];
+};
+
+// ============================================================================
+// Memory - Ring Queue
+// The consumer side of a sample ring, which queues the ready blocks into a
+// player (e.g. a source voice) that holds on to them until they're played.
+// While the player has nothing queued, the blocks are held back until the ring
+// has the preroll blocks ready. When the producer runs on a clock of its own
+// (e.g. another XAudio2 engine), the preroll is a jitter buffer: a late block
+// is covered by the queued ones, and should the queue run dry anyway, the
+// preroll is built up again before the playback continues.
+// ============================================================================
+class RingQueue
+{
+public:
+  explicit RingQueue(SampleRing& ring, size_t preroll = 0) : ring(ring), preroll(preroll)
+  {
+    assert(preroll <= ring.capacity());
+  }
+
+  size_t size() const { return queued; }
+
+  // queue the newly ready blocks into the player by calling submit(view).
+  template <typename Submit>
+  void pump(Submit submit)
+  {
+    auto ready = ring.readable(std::max(queued + 1, preroll));
+    if (queued == 0 && ready < preroll)
+      return;
+    for (; queued < ready; queued++)
+      submit(ring.peek(queued));
+  }
+
+  // the player has finished with the oldest queued block.
+  void release()
+  {
+    assert(queued > 0);
+    ring.release(1);
+    queued--;
+  }
+
+private:
+  SampleRing& ring;
+  size_t      preroll;
+  size_t      queued = 0;
+};
+
+// ============================================================================
+// Memory - Slot Map
+// Maps generation-indexed handles onto the indices of densely packed arrays.
+// A handle is a 32-bit slot index with a 32-bit generation, which is bumped
+// every time the slot gets freed, so stale handles are detected safely. The
+// slots point to the dense index of the element and the dense side points back
+// to the slot, so elements can be removed by moving the last one in its place
+// while the live elements stay packed for cache-friendly iteration.
+// ============================================================================
+struct SoundHandle
+{
+  uint32_t index;
+  uint32_t generation;
+};
+
+const SoundHandle INVALID_SOUND = { 0, 0 };
+const uint32_t    SLOT_INVALID = 0xFFFFFFFF;
+
+class SlotMap
+{
+public:
+  uint32_t size() const { return static_cast<uint32_t>(owners.size()); }
+
+  // reserve a slot for a new element appended to the end of the dense arrays.
+  SoundHandle insert()
+  {
+    auto index = freeHead;
+    if (index == SLOT_INVALID) {
+      index = static_cast<uint32_t>(slots.size());
+      slots.push_back({ 0, 1 });
+    } else {
+      freeHead = slots[index].dense;
+    }
+    slots[index].dense = size();
+    owners.push_back(index);
+    return { index, slots[index].generation };
+  }
+
+  // returns the dense index of the element or SLOT_INVALID for stale handles.
+  uint32_t find(SoundHandle handle) const
+  {
+    if (handle.index >= slots.size() || slots[handle.index].generation != handle.generation)
+      return SLOT_INVALID;
+    return slots[handle.index].dense;
+  }
+
+  // free the slot of a dense element. the caller moves the last element of the
+  // dense arrays into the freed index in the same way.
+  void erase(uint32_t dense)
+  {
+    assert(dense < size());
+    auto index = owners[dense];
+    owners[dense] = owners.back();
+    slots[owners[dense]].dense = dense;
+    owners.pop_back();
+
+    slots[index].generation++;
+    slots[index].dense = freeHead;
+    freeHead = index;
+  }
+
+private:
+  struct Slot
+  {
+    uint32_t dense;      // dense index, or the next free slot when free.
+    uint32_t generation;
+  };
+
+  std::vector<Slot>     slots;
+  std::vector<uint32_t> owners;
+  uint32_t              freeHead = SLOT_INVALID;
+};
@@ -0,0 +1,853 @@
+// ============================================================================
+// XAudio2 Sandbox - Mixer
+// The portable mixing engine, which renders the same kind of audio graph as
+// XAudio2 does, but without any dependencies to the Windows APIs. It is used
+// to render the graphs offline and to measure them (see offline.cpp).
+// ============================================================================
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// SSE intrinsics
+#include <emmintrin.h>
+
+#include "dsp.h"
+#include "memory.h"
+#include "trace.h"
+
+// ============================================================================
+// Mixer - Task Scheduler
+// XAudio2 processes the whole audio graph in a single engine thread, so heavy
+// submix buses will saturate one core while the others are idle. Our portable
+// mixer instead runs the graph as tasks on a work-stealing scheduler.
+//
+// Each worker owns a task queue. Workers take tasks from the back of their own
+// queue (hot in the cache) and steal from the front of the others' queues when
+// they run out of work. Tasks may push new tasks which become ready when they
+// complete, so dependencies are expressed without any central graph walking.
+// The thread calling run takes part into the work as the worker zero.
+//
+// A run may queue all of its tasks into a single worker, so the queues are
+// sized from the graph: the owner reserves room for the tasks of a run before
+// running it, and the queues grow then rather than in the middle of a run.
+// ============================================================================
+class SpinLock
+{
+public:
+  void lock() { while (flag.test_and_set(std::memory_order_acquire)) _mm_pause(); }
+  void unlock() { flag.clear(std::memory_order_release); }
+
+private:
+  std::atomic_flag flag = ATOMIC_FLAG_INIT;
+};
+
+class TaskScheduler
+{
+public:
+  struct Task
+  {
+    void  (*function)(void* context, unsigned int worker);
+    void* context;
+  };
+
+  explicit TaskScheduler(unsigned int workerCount)
+    : workers(new Worker[std::max(workerCount, 1u)]), count(std::max(workerCount, 1u))
+  {
+    for (auto i = 1u; i < count; i++)
+      threads.emplace_back([this, i] { workerLoop(i); });
+  }
+
+  ~TaskScheduler()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    for (auto& thread : threads)
+      thread.join();
+  }
+
+  unsigned int workerCount() const { return count; }
+
+  // make room for the given amount of tasks in each queue. this allocates and
+  // must not overlap a run, so it is called when the graph is built.
+  void reserve(unsigned int taskCount)
+  {
+    for (auto i = 0u; i < count; i++) {
+      auto& queue = workers[i];
+      std::lock_guard<SpinLock> lock(queue.lock);
+      assert(queue.size == 0);
+      if (queue.tasks.size() < taskCount)
+        queue.tasks.resize(taskCount);
+      queue.first = 0;
+    }
+  }
+
+  // push a new ready task into the queue of the given worker.
+  void push(unsigned int worker, Task task)
+  {
+    auto& queue = workers[worker];
+    std::lock_guard<SpinLock> lock(queue.lock);
+    assert(queue.size < queue.tasks.size());
+    queue.tasks[(queue.first + queue.size) % queue.tasks.size()] = task;
+    queue.size++;
+  }
+
+  // start a new run of the given amount of tasks (at most the reserved amount).
+  // this must be called before the tasks of the run are pushed, as a worker
+  // still spinning from the last run may pick up a pushed task right away and
+  // its completion must count.
+  void begin(unsigned int taskCount)
+  {
+    completed.store(0, std::memory_order_relaxed);
+    target.store(taskCount, std::memory_order_release);
+  }
+
+  // run pushed tasks (and the tasks they push) until the run is done.
+  void run()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      epoch++;
+    }
+    wakeup.notify_all();
+    work(0);
+  }
+
+  // get the busy ratio of the worker since the statistics were last reset.
+  double utilisation(unsigned int worker) const
+  {
+    auto elapsed = std::chrono::steady_clock::now() - statisticsStart;
+    auto busy = std::chrono::nanoseconds(workers[worker].busy.load());
+    return std::chrono::duration<double>(busy) / std::chrono::duration<double>(elapsed);
+  }
+
+  void resetStatistics()
+  {
+    for (auto i = 0u; i < count; i++)
+      workers[i].busy = 0;
+    statisticsStart = std::chrono::steady_clock::now();
+  }
+
+private:
+  struct Worker
+  {
+    SpinLock                   lock;
+    std::vector<Task>          tasks;
+    unsigned int               first = 0;
+    unsigned int               size = 0;
+    std::atomic<int64_t>       busy{ 0 };
+    char                       padding[64];
+  };
+
+  bool pop(unsigned int worker, Task& task)
+  {
+    auto& queue = workers[worker];
+    std::lock_guard<SpinLock> lock(queue.lock);
+    if (queue.size == 0) return false;
+    queue.size--;
+    task = queue.tasks[(queue.first + queue.size) % queue.tasks.size()];
+    return true;
+  }
+
+  bool steal(unsigned int worker, Task& task)
+  {
+    for (auto i = 1u; i < count; i++) {
+      auto& queue = workers[(worker + i) % count];
+      std::lock_guard<SpinLock> lock(queue.lock);
+      if (queue.size == 0) continue;
+      task = queue.tasks[queue.first];
+      queue.first = (queue.first + 1) % queue.tasks.size();
+      queue.size--;
+      return true;
+    }
+    return false;
+  }
+
+  void work(unsigned int worker)
+  {
+    auto idle = 0u;
+    while (completed.load(std::memory_order_acquire) < target.load(std::memory_order_acquire)) {
+      Task task;
+      if (!pop(worker, task) && !steal(worker, task)) {
+        // spin a while before giving the core away to the other threads.
+        if (++idle < 64)
+          _mm_pause();
+        else
+          std::this_thread::yield();
+        continue;
+      }
+      idle = 0;
+      auto start = std::chrono::steady_clock::now();
+      task.function(task.context, worker);
+      auto end = std::chrono::steady_clock::now();
+      workers[worker].busy += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+      completed.fetch_add(1, std::memory_order_acq_rel);
+    }
+  }
+
+  void workerLoop(unsigned int worker)
+  {
+    auto seen = 0u;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeup.wait(lock, [&] { return stopping || epoch != seen; });
+        if (stopping) return;
+        seen = epoch;
+      }
+      work(worker);
+    }
+  }
+
+  std::unique_ptr<Worker[]>             workers;
+  unsigned int                          count;
+  std::vector<std::thread>              threads;
+  std::mutex                            mutex;
+  std::condition_variable               wakeup;
+  unsigned int                          epoch = 0;
+  bool                                  stopping = false;
+  std::atomic<unsigned int>             target{ 0 };
+  std::atomic<unsigned int>             completed{ 0 };
+  std::chrono::steady_clock::time_point statisticsStart = std::chrono::steady_clock::now();
+};
+
+// ============================================================================
+// Mixer - Mix Kernels
+// Mix kernels mix a planar block into another through a mix matrix. With the
+// planar layout, each output plane is a weighted sum of the input planes, so
+// the kernels are straight SIMD loops processing four frames at a time.
+//
+// The generic kernel takes the channel counts at runtime, which leaves it with
+// loops over the channels inside the hot loop. The common layouts (mono and
+// stereo into stereo, 5.1 and 7.1) have kernels specialized at compile time,
+// where the channel loops are fully unrolled and the matrix gains are splatted
+// into SIMD vectors once per block. The gains of the small layouts fit into the
+// 16 XMM registers of x64 next to the samples, but the 36 and 64 gains of the
+// 6x6 and 8x8 layouts don't: those stay on the stack and are read from the L1
+// cache as memory operands, which still saves the splat per frame. The kernel
+// is selected once when the matrix is set, so the generic kernel is only used
+// for the rare layouts.
+// ============================================================================
+typedef void (*MixKernel)(const float* const* input, unsigned int inputs,
+                          float* const* output, unsigned int outputs,
+                          const float* matrix, float volume, unsigned int frames);
+
+// add a plane multiplied by a gain into another plane.
+inline void mixPlane(const float* input, float* output, float gain, unsigned int frames)
+{
+  auto g = _mm_set1_ps(gain);
+  auto i = 0u;
+  for (; i + 4 <= frames; i += 4)
+    _mm_storeu_ps(output + i, _mm_add_ps(_mm_loadu_ps(output + i), _mm_mul_ps(_mm_loadu_ps(input + i), g)));
+  for (; i < frames; i++)
+    output[i] += input[i] * gain;
+}
+
+inline void mixBlock(const float* const* input, unsigned int inputs,
+                     float* const* output, unsigned int outputs,
+                     const float* matrix, float volume, unsigned int frames)
+{
+  for (auto o = 0u; o < outputs; o++)
+    for (auto c = 0u; c < inputs; c++)
+      mixPlane(input[c], output[o], matrix[o * inputs + c] * volume, frames);
+}
+
+// a layout specialized kernel where the compiler sees the channel counts.
+template <unsigned int Inputs, unsigned int Outputs>
+void mixKernel(const float* const* input, unsigned int, float* const* output, unsigned int,
+               const float* matrix, float volume, unsigned int frames)
+{
+  __m128 gains[Outputs * Inputs];
+  for (auto i = 0u; i < Outputs * Inputs; i++)
+    gains[i] = _mm_set1_ps(matrix[i] * volume);
+
+  auto i = 0u;
+  for (; i + 4 <= frames; i += 4) {
+    __m128 x[Inputs];
+    for (auto c = 0u; c < Inputs; c++)
+      x[c] = _mm_loadu_ps(input[c] + i);
+    for (auto o = 0u; o < Outputs; o++) {
+      auto y = _mm_loadu_ps(output[o] + i);
+      for (auto c = 0u; c < Inputs; c++)
+        y = _mm_add_ps(y, _mm_mul_ps(x[c], gains[o * Inputs + c]));
+      _mm_storeu_ps(output[o] + i, y);
+    }
+  }
+  for (; i < frames; i++)
+    for (auto o = 0u; o < Outputs; o++)
+      for (auto c = 0u; c < Inputs; c++)
+        output[o][i] += input[c][i] * matrix[o * Inputs + c] * volume;
+}
+
+// select the best mix kernel for the given input and output channel counts.
+inline MixKernel selectMixKernel(unsigned int inputs, unsigned int outputs)
+{
+  if (inputs == 1 && outputs == 2) return mixKernel<1, 2>;
+  if (inputs == 2 && outputs == 2) return mixKernel<2, 2>;
+  if (inputs == 1 && outputs == 6) return mixKernel<1, 6>;
+  if (inputs == 2 && outputs == 6) return mixKernel<2, 6>;
+  if (inputs == 6 && outputs == 6) return mixKernel<6, 6>;
+  if (inputs == 1 && outputs == 8) return mixKernel<1, 8>;
+  if (inputs == 2 && outputs == 8) return mixKernel<2, 8>;
+  if (inputs == 8 && outputs == 8) return mixKernel<8, 8>;
+  return mixBlock;
+}
+
+// ============================================================================
+// Mixer - Mix Matrix
+// Most mix matrices are mostly zeros: a panned mono voice only feeds two or
+// three of the eight 7.1 speakers and a stereo voice in 5.1 only the front
+// pair. The matrix keeps a sparse pattern of its non-zero gains, which is
+// rebuilt whenever the matrix is set, and dispatches to the cheapest kernel.
+//   silent.....No non-zero gains, nothing is mixed.
+//   diagonal...Each output has at most one input, mixed as a scaled plane.
+//   sparse.....At most half of the gains are non-zero, each output plane is
+//              read and written once and accumulates its own inputs only.
+//   dense......The layout specialized (or the generic) dense kernel.
+// ============================================================================
+const unsigned int MIX_MAX_CHANNELS = 64;
+
+enum MixLayout
+{
+  MIX_SILENT,
+  MIX_DIAGONAL,
+  MIX_SPARSE,
+  MIX_DENSE
+};
+
+struct MixTerm
+{
+  unsigned int input;
+  unsigned int output;
+  float        gain;
+};
+
+class MixMatrix
+{
+public:
+  MixMatrix() = default;
+
+  MixMatrix(unsigned int inputs, unsigned int outputs, const std::vector<float>& gains)
+    : inputs(inputs), outputs(outputs), dense(selectMixKernel(inputs, outputs))
+  {
+    set(gains);
+  }
+
+  MixLayout layout() const { return pattern; }
+  const std::vector<float>& gains() const { return matrix; }
+
+  // replace the output x input gains and rebuild the sparse pattern.
+  void set(const std::vector<float>& gains)
+  {
+    assert(gains.size() == size_t(inputs) * outputs);
+    matrix = gains;
+    terms.clear();
+    rows.assign(outputs + 1, 0);
+    auto diagonal = true;
+    for (auto o = 0u; o < outputs; o++) {
+      rows[o] = static_cast<unsigned int>(terms.size());
+      for (auto c = 0u; c < inputs; c++)
+        if (matrix[o * inputs + c] != 0.f)
+          terms.push_back({ c, o, matrix[o * inputs + c] });
+      diagonal = diagonal && terms.size() - rows[o] <= 1;
+    }
+    rows[outputs] = static_cast<unsigned int>(terms.size());
+
+    if (terms.empty())
+      pattern = MIX_SILENT;
+    else if (diagonal)
+      pattern = MIX_DIAGONAL;
+    else if (terms.size() * 2 <= matrix.size())
+      pattern = MIX_SPARSE;
+    else
+      pattern = MIX_DENSE;
+  }
+
+  void mix(const float* const* input, float* const* output, float volume, unsigned int frames) const
+  {
+    switch (pattern) {
+    case MIX_SILENT:
+      break;
+    case MIX_DIAGONAL:
+      for (auto& term : terms)
+        mixPlane(input[term.input], output[term.output], term.gain * volume, frames);
+      break;
+    case MIX_SPARSE:
+      mixRows(input, output, volume, frames);
+      break;
+    case MIX_DENSE:
+      dense(input, inputs, output, outputs, matrix.data(), volume, frames);
+      break;
+    }
+  }
+
+private:
+  void mixRows(const float* const* input, float* const* output, float volume, unsigned int frames) const
+  {
+    __m128 g[MIX_MAX_CHANNELS];
+    const float* x[MIX_MAX_CHANNELS];
+    for (auto o = 0u; o < outputs; o++) {
+      auto first = rows[o], count = rows[o + 1] - rows[o];
+      if (count == 0) continue;
+      assert(count <= MIX_MAX_CHANNELS);
+      for (auto k = 0u; k < count; k++) {
+        g[k] = _mm_set1_ps(terms[first + k].gain * volume);
+        x[k] = input[terms[first + k].input];
+      }
+      auto y = output[o];
+      auto i = 0u;
+      for (; i + 4 <= frames; i += 4) {
+        auto sum = _mm_loadu_ps(y + i);
+        for (auto k = 0u; k < count; k++)
+          sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(x[k] + i), g[k]));
+        _mm_storeu_ps(y + i, sum);
+      }
+      for (; i < frames; i++)
+        for (auto k = 0u; k < count; k++)
+          y[i] += x[k][i] * terms[first + k].gain * volume;
+    }
+  }
+
+  unsigned int              inputs = 0;
+  unsigned int              outputs = 0;
+  MixKernel                 dense = mixBlock;
+  MixLayout                 pattern = MIX_SILENT;
+  std::vector<float>        matrix;   // output x input channel volumes.
+  std::vector<MixTerm>      terms;    // non-zero gains ordered by output.
+  std::vector<unsigned int> rows;     // the terms of output o are [rows[o], rows[o + 1]).
+};
+
+// ============================================================================
+// Mixer - Portable Mixing Engine
+// The portable mixer mirrors the XAudio2 audio graph without any dependencies
+// to the Windows APIs, so that the graph can be rendered offline and measured.
+//   1. MixVoice is a source voice which plays planar float samples.
+//   2. MixBus is a submix (or the mastering) bus with an effect chain.
+//
+// Voices and buses mix into their output bus through a mix matrix, in the same
+// way as XAudio2 does. All voices must run at the sample rate of the mixer, as
+// the mixer does not implement any sample rate conversion.
+//
+// Each bus is a task which is ready once all of its input buses are processed,
+// so independent submix subtrees are processed in parallel and joined at the
+// mastering bus. If a submix bus is started after the quantum deadline has
+// passed, its effects are bypassed, so a late quantum does not miss the deadline
+// further. The effects of the mastering bus (e.g. the limiter) always run and
+// the deadline can be disabled altogether when the graph is rendered offline.
+//
+// Voices share their samples, so any number of voices can play the same sound
+// without a copy of it.
+//
+// Silence is propagated through the graph: a bus is silent when none of its
+// voices and input buses carry any signal, and its effects are skipped once
+// the input has been silent for the tail of the chain up to each effect. The
+// silent voices and buses are not mixed at all, so the cost of a sparse scene
+// follows the number of audible voices rather than the size of the graph.
+//
+// A bus can duck other buses with a sidechain keyed from its processed output.
+// The ducked target buses also wait for the key bus, so they are ducked within
+// the same pass. The key bus must not be fed by any of its targets.
+// ============================================================================
+class Mixer;
+struct MixBus;
+struct MixDucking;
+
+struct MixVoice
+{
+  std::shared_ptr<const PlanarBuffer> samples;
+  unsigned int                        channels;
+  unsigned int                        frames;
+  unsigned int                        position;
+  float                               volume;
+  bool                                playing;
+  MixMatrix                           matrix;
+  MixBus*                             output;
+};
+
+struct MixBus
+{
+  unsigned int                           channels;
+  float                                  volume;
+  PlanarBuffer                           buffer;
+  MixMatrix                              matrix;
+  std::vector<std::unique_ptr<DspBlock>> effects;
+  std::vector<unsigned int>              tails;    // tail of the chain up to each effect.
+  unsigned int                           silentFrames;
+  bool                                   silent;
+  std::vector<MixVoice*>                 voices;
+  std::vector<MixBus*>                   inputs;
+  std::vector<MixDucking*>               keys;     // duckings keyed by this bus.
+  std::vector<MixDucking*>               duckers;  // duckings targeting this bus.
+  MixBus*                                output;
+  Mixer*                                 mixer;
+  std::atomic<unsigned int>              pending;
+};
+
+struct MixDucking
+{
+  Sidechain            sidechain;
+  MixBus*              key;
+  std::vector<MixBus*> targets;
+};
+
+// build the default mix matrix similar to the one that XAudio2 uses.
+inline std::vector<float> defaultMatrix(unsigned int inputs, unsigned int outputs)
+{
+  std::vector<float> matrix(inputs * outputs, 0.f);
+  if (inputs == 1 && outputs >= 2) {
+    matrix[0 * inputs] = 0.7071068f;
+    matrix[1 * inputs] = 0.7071068f;
+  } else {
+    for (auto i = 0u; i < inputs; i++)
+      matrix[(i % outputs) * inputs + i] = 1.f;
+  }
+  return matrix;
+}
+
+class Mixer
+{
+public:
+  Mixer(unsigned int channels, unsigned int sampleRate, unsigned int quantumFrames,
+        unsigned int workers = std::thread::hardware_concurrency())
+    : sampleRate(sampleRate), quantumFrames(quantumFrames), scheduler(workers)
+  {
+    masterBus = createSubmix(channels, nullptr);
+  }
+
+  MixBus* master() { return masterBus; }
+  TaskScheduler& tasks() { return scheduler; }
+  unsigned int overruns() const { return deadlineMisses; }
+
+  // enable or disable the bypass of late submix effects (enabled by default).
+  void setDeadline(bool enabled) { deadlineEnabled = enabled; }
+
+  // create a new bus which outputs into the given bus (or the master bus).
+  MixBus* createSubmix(unsigned int channels, MixBus* output)
+  {
+    buses.emplace_back(new MixBus());
+    auto bus = buses.back().get();
+    bus->channels = channels;
+    bus->volume = 1.f;
+    bus->buffer = PlanarBuffer(channels, quantumFrames);
+    bus->silentFrames = 0;
+    bus->silent = false;
+    bus->mixer = this;
+    bus->output = output ? output : masterBus;
+    scheduler.reserve(static_cast<unsigned int>(buses.size()));
+    if (bus->output) {
+      bus->matrix = MixMatrix(channels, bus->output->channels, defaultMatrix(channels, bus->output->channels));
+      bus->output->inputs.push_back(bus);
+    }
+    return bus;
+  }
+
+  // add a new effect into the end of the bus effect chain.
+  void addEffect(MixBus* bus, std::unique_ptr<DspBlock> effect)
+  {
+    effect->prepare(bus->channels, sampleRate, quantumFrames);
+    bus->tails.push_back(addFrames(bus->tails.empty() ? 0 : bus->tails.back(), effect->tail()));
+    bus->effects.push_back(std::move(effect));
+  }
+
+  // duck the target buses with a single sidechain keyed from the key bus.
+  MixDucking* addDucking(MixBus* key, const std::vector<MixBus*>& targets, const DuckingParameters& parameters)
+  {
+    duckings.emplace_back(new MixDucking{ Sidechain(parameters), key, targets });
+    auto ducking = duckings.back().get();
+    ducking->sidechain.prepare(sampleRate, quantumFrames);
+    key->keys.push_back(ducking);
+    for (auto target : targets) {
+      for (auto bus = target; bus; bus = bus->output)
+        assert(bus != key);
+      target->duckers.push_back(ducking);
+    }
+    return ducking;
+  }
+
+  // create a new voice which plays the given samples into the given bus. the
+  // samples must be at the sample rate of the mixer.
+  MixVoice* createVoice(std::shared_ptr<const PlanarBuffer> samples, MixBus* output = nullptr)
+  {
+    assert(samples && samples->channels() <= MIX_MAX_CHANNELS);
+
+    voices.emplace_back(new MixVoice());
+    auto voice = voices.back().get();
+    voice->channels = samples->channels();
+    voice->frames = samples->frames();
+    voice->samples = std::move(samples);
+    voice->position = 0;
+    voice->volume = 1.f;
+    voice->playing = false;
+    voice->output = output ? output : masterBus;
+    voice->matrix = MixMatrix(voice->channels, voice->output->channels,
+                              defaultMatrix(voice->channels, voice->output->channels));
+    voice->output->voices.push_back(voice);
+    return voice;
+  }
+
+  // render the next quantum of the graph into the interleaved output buffer.
+  // this is the only place where the planar bus data gets interleaved.
+  void render(float* output, unsigned int frames)
+  {
+    process(frames);
+    interleave(masterBus->buffer, output, frames);
+  }
+
+  // render the next quantum of the graph into the planar master bus buffer.
+  void process(unsigned int frames)
+  {
+    assert(frames <= quantumFrames);
+    AudioThreadScope audio;
+    TraceScope trace("mixer render");
+
+    renderFrames = frames;
+    auto quantum = std::chrono::duration<double>(double(frames) / sampleRate);
+    deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(quantum);
+
+    // leaf buses are ready right away, others when all their inputs are done.
+    scheduler.begin(static_cast<unsigned int>(buses.size()));
+    auto worker = 0u;
+    for (auto& bus : buses) {
+      auto pending = static_cast<unsigned int>(bus->inputs.size() + bus->duckers.size());
+      bus->pending = pending;
+      if (pending == 0)
+        scheduler.push(worker++ % scheduler.workerCount(), { processBusTask, bus.get() });
+    }
+    scheduler.run();
+  }
+
+private:
+  static void processBusTask(void* context, unsigned int worker)
+  {
+    AudioThreadScope audio;
+    auto bus = static_cast<MixBus*>(context);
+    bus->mixer->processBus(*bus);
+
+    // the output bus and the ducked buses become ready when the last bus they
+    // wait for is processed.
+    auto ready = [&](MixBus* waiting) {
+      if (waiting->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        bus->mixer->scheduler.push(worker, { processBusTask, waiting });
+    };
+    for (auto ducking : bus->keys)
+      for (auto target : ducking->targets)
+        ready(target);
+    if (bus->output)
+      ready(bus->output);
+  }
+
+  void processBus(MixBus& bus)
+  {
+    TraceScope trace("mixer bus");
+    auto frames = renderFrames;
+    auto silent = true;
+    bus.buffer.clear(frames);
+
+    // mix the playing voices into the bus, muted voices just advance.
+    for (auto voice : bus.voices) {
+      if (!voice->playing) continue;
+      auto count = std::min(frames, voice->frames - voice->position);
+      if (voice->volume != 0.f) {
+        const float* source[MIX_MAX_CHANNELS];
+        for (auto c = 0u; c < voice->channels; c++)
+          source[c] = voice->samples->channel(c) + voice->position;
+        voice->matrix.mix(source, bus.buffer.data(), voice->volume, count);
+        silent = false;
+      }
+      voice->position += count;
+      if (voice->position >= voice->frames)
+        voice->playing = false;
+    }
+
+    // mix the already processed input buses into the bus.
+    for (auto input : bus.inputs) {
+      if (input->silent || input->volume == 0.f) continue;
+      input->matrix.mix(input->buffer.data(), bus.buffer.data(), input->volume, frames);
+      silent = false;
+    }
+    auto silentBefore = bus.silentFrames;
+    bus.silentFrames = silent ? addFrames(silentBefore, frames) : 0;
+
+    // process the effect chain unless the quantum is already late, where the
+    // mastering bus is never bypassed. the effects whose input has been silent
+    // longer than their tail are skipped.
+    if (deadlineEnabled && bus.output && std::chrono::steady_clock::now() > deadline) {
+      deadlineMisses++;
+    } else {
+      for (auto i = 0u; i < bus.effects.size(); i++) {
+        auto tail = bus.tails[i];
+        if (silent && tail != DSP_TAIL_INFINITE && silentBefore >= tail) {
+          bus.effects[i]->skip(frames);
+        } else {
+          bus.effects[i]->process(bus.buffer.data(), frames);
+          silent = false;
+        }
+      }
+    }
+    bus.silent = silent;
+
+    // duck the bus with the keys processed earlier and then key the others.
+    if (!silent)
+      for (auto ducking : bus.duckers)
+        ducking->sidechain.apply(bus.buffer.data(), bus.channels, frames);
+    for (auto ducking : bus.keys)
+      ducking->sidechain.analyze(bus.buffer.data(), bus.channels, frames);
+  }
+
+  unsigned int                             sampleRate;
+  unsigned int                             quantumFrames;
+  unsigned int                             renderFrames = 0;
+  std::atomic<unsigned int>                deadlineMisses{ 0 };
+  std::chrono::steady_clock::time_point    deadline;
+  bool                                     deadlineEnabled = true;
+  std::vector<std::unique_ptr<MixBus>>     buses;
+  std::vector<std::unique_ptr<MixVoice>>   voices;
+  std::vector<std::unique_ptr<MixDucking>> duckings;
+  MixBus*                                  masterBus = nullptr;
+  TaskScheduler                            scheduler;
+};
+
+// ============================================================================
+// Mixer - Sharding
+// A heavy scene can be split into independent mixer shards, where each shard
+// mixes its own partition of the voices and buses with a scheduler of its own.
+// The shards are rendered in parallel as tasks of an outer scheduler and their
+// master buses are summed in the final stage, which also runs the master bus
+// effects. This mirrors the sharded XAudio2 engines for benchmarking purposes.
+// ============================================================================
+class ShardedMixer
+{
+public:
+  ShardedMixer(unsigned int channels, unsigned int sampleRate, unsigned int quantumFrames, unsigned int shardCount)
+    : sampleRate(sampleRate), quantumFrames(quantumFrames), scheduler(shardCount),
+      master(channels, quantumFrames)
+  {
+    assert(shardCount > 0);
+    for (auto i = 0u; i < shardCount; i++) {
+      shards.emplace_back(new Mixer(channels, sampleRate, quantumFrames, 1));
+      contexts.push_back({ this, shards.back().get() });
+    }
+    scheduler.reserve(shardCount);
+  }
+
+  unsigned int shardCount() const { return static_cast<unsigned int>(shards.size()); }
+  Mixer& shard(unsigned int index) { return *shards[index % shards.size()]; }
+  TaskScheduler& tasks() { return scheduler; }
+
+  unsigned int overruns() const
+  {
+    auto count = 0u;
+    for (auto& shard : shards)
+      count += shard->overruns();
+    return count;
+  }
+
+  void setDeadline(bool enabled)
+  {
+    for (auto& shard : shards)
+      shard->setDeadline(enabled);
+  }
+
+  // add a new effect into the end of the merged master effect chain.
+  void addEffect(std::unique_ptr<DspBlock> effect)
+  {
+    effect->prepare(master.channels(), sampleRate, quantumFrames);
+    effects.push_back(std::move(effect));
+  }
+
+  // render the shards in parallel and merge them into the interleaved output.
+  void render(float* output, unsigned int frames)
+  {
+    assert(frames <= quantumFrames);
+    AudioThreadScope audio;
+    TraceScope trace("sharded render");
+
+    renderFrames = frames;
+    scheduler.begin(shardCount());
+    for (auto i = 0u; i < contexts.size(); i++)
+      scheduler.push(i % scheduler.workerCount(), { renderShardTask, &contexts[i] });
+    scheduler.run();
+
+    // sum the shard master buses and process the final effect chain.
+    master.clear(frames);
+    for (auto& shard : shards) {
+      if (shard->master()->silent) continue;
+      for (auto c = 0u; c < master.channels(); c++)
+        mixPlane(shard->master()->buffer.channel(c), master.channel(c), 1.f, frames);
+    }
+    for (auto& effect : effects)
+      effect->process(master.data(), frames);
+    interleave(master, output, frames);
+  }
+
+private:
+  struct ShardContext
+  {
+    ShardedMixer* owner;
+    Mixer*        mixer;
+  };
+
+  static void renderShardTask(void* context, unsigned int)
+  {
+    auto shard = static_cast<ShardContext*>(context);
+    shard->mixer->process(shard->owner->renderFrames);
+  }
+
+  unsigned int                            sampleRate;
+  unsigned int                            quantumFrames;
+  unsigned int                            renderFrames = 0;
+  TaskScheduler                           scheduler;
+  std::vector<std::unique_ptr<Mixer>>     shards;
+  std::vector<ShardContext>               contexts;
+  std::vector<std::unique_ptr<DspBlock>>  effects;
+  PlanarBuffer                            master;
+};
+
+// ============================================================================
+// Mixer - Shard Tap
+// The sharded XAudio2 engines are merged through sample rings: the last block
+// of each shard master bus captures its output into a ring and silences it,
+// and the merge stage streams the rings with a preroll (see RingQueue). The
+// captured blocks are interleaved, as the source voices play interleaved data.
+// ============================================================================
+class ShardTap : public DspBlock
+{
+public:
+  explicit ShardTap(SampleRing& ring) : ring(ring) {}
+
+  void prepare(unsigned int channels, unsigned int, unsigned int) override
+  {
+    channelCount = channels;
+  }
+
+  void process(float* const* planes, unsigned int frames) override
+  {
+    // the block is dropped when the merge stage falls behind.
+    auto block = reinterpret_cast<float*>(ring.acquire());
+    if (block) {
+      auto captured = std::min(frames, static_cast<unsigned int>(ring.blockCapacity() / (channelCount * sizeof(float))));
+      for (auto c = 0u; c < channelCount; c++)
+        for (auto i = 0u; i < captured; i++)
+          block[i * channelCount + c] = planes[c][i];
+      ring.commit(captured * channelCount * sizeof(float));
+    }
+    for (auto c = 0u; c < channelCount; c++)
+      std::fill(planes[c], planes[c] + frames, 0.f);
+  }
+
+  unsigned int tail() const override { return 0; }
+
+private:
+  SampleRing&  ring;
+  unsigned int channelCount = 0;
+};
@@ -0,0 +1,24 @@
+// ============================================================================
+// XAudio2 Sandbox - Offline
+// The DSP blocks, the portable mixer and the memory utilities don't depend on
+// any Windows API, so they can be built without the sandbox on any platform
+// with SSE2 (see CMakeLists.txt). This is the entry point of that build.
+//   --bench...Runs the portable benchmarks.
+//   --test....Runs the portable tests, which are also registered with ctest.
+// ============================================================================
+#include <iostream>
+#include <string>
+
+#include "benchmark.h"
+#include "test.h"
+
+int main(int argc, char* argv[])
+{
+  if (argc > 1 && std::string(argv[1]) == "--bench")
+    return runBenchmarks();
+  if (argc > 1 && std::string(argv[1]) == "--test")
+    return runTests();
+
+  std::cerr << "usage: " << argv[0] << " --bench|--test" << std::endl;
+  return 1;
+}
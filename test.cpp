@@ -0,0 +1,710 @@
+#include "test.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bank.h"
+#include "benchmark.h"
+#include "dsp.h"
+#include "memory.h"
+#include "mixer.h"
+
+// ============================================================================
+// Test - Reporting
+// Each test measures the largest error of the output against its reference,
+// relative to the peak of the reference, and passes when it's within the given
+// tolerance. A tolerance of zero requires the outputs to match exactly.
+// ============================================================================
+bool report(const char* name, double error, double tolerance)
+{
+  auto passed = error <= tolerance;
+  std::cout << "test " << name << ": " << (passed ? "ok" : "FAILED")
+            << ", max error " << error << " (tolerance " << tolerance << ")" << std::endl;
+  return passed;
+}
+
+// accumulates the largest error against a reference relative to its peak.
+class ErrorMeter
+{
+public:
+  void add(double value, double reference)
+  {
+    error = std::max(error, std::abs(value - reference));
+    peak = std::max(peak, std::abs(reference));
+  }
+
+  // a silent reference fails, as it would hide a test that renders nothing.
+  double relative() const { return peak > 0.0 ? error / peak : std::numeric_limits<double>::infinity(); }
+
+private:
+  double error = 0.0;
+  double peak = 0.0;
+};
+
+// ============================================================================
+// Test - FFT
+// Compares the forward transform against a direct DFT computed with doubles
+// and checks that the unscaled inverse of the forward transform restores the
+// input multiplied by the size.
+// ============================================================================
+bool testFft()
+{
+  const auto pi = 3.14159265358979323846;
+  ErrorMeter forward, roundTrip;
+  for (auto n : { 2u, 8u, 64u, 1024u }) {
+    Fft fft(n);
+    std::vector<float> re(n), im(n);
+    fillNoise(re.data(), n, n);
+    fillNoise(im.data(), n, n + 1);
+    auto inputRe = re, inputIm = im;
+
+    fft.transform(re.data(), im.data(), false);
+    for (auto k = 0u; k < n; k++) {
+      auto sumRe = 0.0, sumIm = 0.0;
+      for (auto t = 0u; t < n; t++) {
+        auto w = -2.0 * pi * double(k) * t / n;
+        sumRe += inputRe[t] * std::cos(w) - inputIm[t] * std::sin(w);
+        sumIm += inputRe[t] * std::sin(w) + inputIm[t] * std::cos(w);
+      }
+      forward.add(re[k], sumRe);
+      forward.add(im[k], sumIm);
+    }
+
+    fft.transform(re.data(), im.data(), true);
+    for (auto t = 0u; t < n; t++) {
+      roundTrip.add(re[t] / n, inputRe[t]);
+      roundTrip.add(im[t] / n, inputIm[t]);
+    }
+  }
+  auto passed = report("fft vs dft", forward.relative(), 1e-5);
+  return report("fft round trip", roundTrip.relative(), 1e-5) && passed;
+}
+
+// ============================================================================
+// Test - Convolution Reverb
+// Compares the partitioned convolution against a direct convolution computed
+// with doubles. The convolution has a latency of one partition, and it's fed
+// with blocks that don't line up with the partitions.
+// ============================================================================
+bool testConvolution()
+{
+  const auto rate = 48000u;
+  const auto quantum = 480u;
+  const auto frames = 24u * quantum;
+  const auto predelay = 100u;
+  const auto channels = 2u;
+
+  // a decaying noise burst as the impulse response.
+  auto decayingNoise = [] {
+    auto impulse = noise(channels, 3000, 7);
+    for (auto c = 0u; c < channels; c++)
+      for (auto i = 0u; i < impulse.frames(); i++)
+        impulse.channel(c)[i] *= std::exp(-3.f * i / impulse.frames());
+    return impulse;
+  };
+  auto impulse = decayingNoise();
+  auto input = noise(channels, frames, 11);
+
+  auto passed = true;
+  for (auto partition : { 64u, 256u }) {
+    ConvolutionReverb reverb(decayingNoise(), rate, predelay, { partition, 1.f, 0.f });
+    reverb.prepare(channels, rate, quantum);
+
+    PlanarBuffer output(channels, frames);
+    for (auto c = 0u; c < channels; c++)
+      std::copy(input.channel(c), input.channel(c) + frames, output.channel(c));
+    for (auto done = 0u; done < frames; done += quantum) {
+      float* planes[2] = { output.channel(0) + done, output.channel(1) + done };
+      reverb.process(planes, quantum);
+    }
+
+    ErrorMeter error;
+    for (auto c = 0u; c < channels; c++) {
+      for (auto n = 0u; n < frames; n++) {
+        auto sum = 0.0;
+        for (auto j = 0u; j < impulse.frames(); j++) {
+          auto t = int(n) - int(partition) - int(predelay) - int(j);
+          if (t >= 0)
+            sum += double(impulse.channel(c)[j]) * input.channel(c)[t];
+        }
+        error.add(output.channel(c)[n], sum);
+      }
+    }
+    passed = report(partition == 64 ? "convolution (64 frame partitions)" : "convolution (256 frame partitions)",
+                    error.relative(), 1e-5) && passed;
+  }
+  return passed;
+}
+
+// ============================================================================
+// Test - Resampling
+// Resamples a pair of sines from 44.1kHz to 48kHz and compares them against
+// the same sines computed at 48kHz, away from the edges where the filter runs
+// out of input. An impulse response at 44.1kHz is then convolved at 48kHz: the
+// impulses of the response must land on the frames scaled by the rate ratio.
+// ============================================================================
+bool testResample()
+{
+  const auto pi = 3.14159265358979323846;
+  const auto from = 44100u, to = 48000u;
+  auto sines = [&](unsigned int rate, unsigned int frames) {
+    PlanarBuffer planes(1, frames);
+    for (auto i = 0u; i < frames; i++)
+      planes.channel(0)[i] = float(0.5 * std::sin(2.0 * pi * 1000.0 * i / rate) + 0.25 * std::sin(2.0 * pi * 15000.0 * i / rate));
+    return planes;
+  };
+  auto input = sines(from, from / 10);
+  auto output = resample(input, from, to);
+  auto expected = sines(to, output.frames());
+  ErrorMeter error;
+  for (auto i = 200u; i + 200 < output.frames(); i++)
+    error.add(output.channel(0)[i], expected.channel(0)[i]);
+  auto passed = report("resample 44.1kHz to 48kHz", error.relative(), 1e-3);
+
+  // a 10ms pre-delay and impulses 0 and 100ms into the response.
+  const auto partition = 256u;
+  PlanarBuffer impulse(1, from / 5);
+  impulse.channel(0)[0] = 1.f;
+  impulse.channel(0)[from / 10] = 0.5f;
+  ConvolutionReverb reverb(std::move(impulse), from, from / 100, { partition, 1.f, 0.f });
+  reverb.prepare(1, to, partition);
+  PlanarBuffer signal(1, to / 2);
+  signal.channel(0)[0] = 1.f;
+  for (auto done = 0u; done < signal.frames(); done += partition) {
+    float* planes[1] = { signal.channel(0) + done };
+    reverb.process(planes, std::min(partition, signal.frames() - done));
+  }
+  ErrorMeter peaks;
+  const auto first = partition + to / 100, second = first + to / 10;
+  peaks.add(signal.channel(0)[first], 1.0);
+  peaks.add(signal.channel(0)[second], 0.5);
+  peaks.add(peakAbs(signal.channel(0), first), 0.0);
+  return report("convolution (44.1kHz impulse at 48kHz)", peaks.relative(), 1e-3) && passed;
+}
+
+// ============================================================================
+// Test - Biquad Filter Bank
+// Compares the vectorized filter bank against biquads computed with doubles,
+// with a voice count that leaves a partial group of lanes and with blocks that
+// leave partial groups of frames.
+// ============================================================================
+bool testBiquadBank()
+{
+  const auto pi = 3.14159265358979323846;
+  const auto rate = 48000.f;
+  const auto voices = 13u;
+  const auto frames = 2000u;
+  const unsigned int blocks[] = { 333u, 7u, 660u, 1000u };
+
+  std::vector<float> frequency(voices), q(voices), gain(voices);
+  for (auto i = 0u; i < voices; i++) {
+    frequency[i] = 200.f + 1500.f * i;
+    q[i] = 0.5f + 0.25f * i;
+    gain[i] = -12.f + 2.f * i;
+  }
+
+  auto passed = true;
+  for (auto peaking : { false, true }) {
+    BiquadBank bank(voices);
+    if (peaking)
+      bank.setPeaking(frequency.data(), q.data(), gain.data(), rate);
+    else
+      bank.setLowpass(frequency.data(), q.data(), rate);
+    auto signals = noise(voices, frames, 3);
+    auto input = noise(voices, frames, 3);
+    auto offset = 0u;
+    for (auto block : blocks) {
+      std::vector<float*> planes(voices);
+      for (auto v = 0u; v < voices; v++)
+        planes[v] = signals.channel(v) + offset;
+      bank.process(planes.data(), block);
+      offset += block;
+    }
+
+    // the same RBJ cookbook filters in the transposed direct form II.
+    ErrorMeter error;
+    for (auto v = 0u; v < voices; v++) {
+      auto w = 2.0 * pi * frequency[v] / rate;
+      auto cosw = std::cos(w);
+      auto alpha = std::sin(w) / (2.0 * q[v]);
+      auto a = std::pow(10.0, gain[v] / 40.0);
+      double c[6] = { (1.0 - cosw) / 2.0, 1.0 - cosw, (1.0 - cosw) / 2.0, 1.0 + alpha, -2.0 * cosw, 1.0 - alpha };
+      if (peaking) {
+        double p[6] = { 1.0 + alpha * a, -2.0 * cosw, 1.0 - alpha * a, 1.0 + alpha / a, -2.0 * cosw, 1.0 - alpha / a };
+        std::copy(p, p + 6, c);
+      }
+      auto z1 = 0.0, z2 = 0.0;
+      for (auto i = 0u; i < frames; i++) {
+        auto x = double(input.channel(v)[i]);
+        auto y = c[0] / c[3] * x + z1;
+        z1 = c[1] / c[3] * x - c[4] / c[3] * y + z2;
+        z2 = c[2] / c[3] * x - c[5] / c[3] * y;
+        error.add(signals.channel(v)[i], y);
+      }
+    }
+    passed = report(peaking ? "biquad bank (peaking)" : "biquad bank (low-pass)", error.relative(), 1e-4) && passed;
+  }
+  return passed;
+}
+
+// ============================================================================
+// Test - Limiter Ceiling
+// Drives the master limiter with stereo noise whose peaks are 18dB above its
+// ceiling. Once the lookahead is filled, no output sample may exceed the -1dBFS
+// ceiling, while the loudest peaks still have to reach it.
+// ============================================================================
+bool testLimiter()
+{
+  const auto rate = 48000u;
+  const auto quantum = rate / 100;
+  const auto ceiling = std::pow(10.f, MASTER_LIMITER.threshold / 20.f);
+  const auto drive = std::pow(10.f, (MASTER_LIMITER.threshold + 18.f) / 20.f);
+
+  auto signal = noise(2, rate, 5);
+  auto peak = std::max(peakAbs(signal.channel(0), rate), peakAbs(signal.channel(1), rate));
+  for (auto c = 0u; c < 2; c++)
+    for (auto i = 0u; i < rate; i++)
+      signal.channel(c)[i] *= drive / peak;
+
+  Dynamics limiter(MASTER_LIMITER);
+  limiter.prepare(2, rate, quantum);
+  for (auto done = 0u; done < rate; done += quantum) {
+    float* planes[2] = { signal.channel(0) + done, signal.channel(1) + done };
+    limiter.process(planes, quantum);
+  }
+  const auto skip = static_cast<unsigned int>(MASTER_LIMITER.lookahead * 0.001f * rate);
+  auto output = std::max(peakAbs(signal.channel(0) + skip, rate - skip), peakAbs(signal.channel(1) + skip, rate - skip));
+  auto passed = report("limiter ceiling overshoot", std::max(0.f, output - ceiling) / ceiling, 1e-4);
+  return report("limiter ceiling reached", std::abs(output - ceiling) / ceiling, 0.05) && passed;
+}
+
+// ============================================================================
+// Test - Mix Kernels
+// Compares the layout specialized kernels and each of the sparse dispatches of
+// the mix matrix against the generic kernel, which mixes plane by plane.
+// ============================================================================
+void compareMix(unsigned int inputs, unsigned int outputs, const std::vector<float>& gains, ErrorMeter& error)
+{
+  const auto frames = 483u;
+  const auto volume = 0.8f;
+  auto input = noise(inputs, frames, inputs);
+  auto expected = noise(outputs, frames, 100);
+  auto kernel = noise(outputs, frames, 100);
+  auto matrix = noise(outputs, frames, 100);
+
+  mixBlock(input.data(), inputs, expected.data(), outputs, gains.data(), volume, frames);
+  selectMixKernel(inputs, outputs)(input.data(), inputs, kernel.data(), outputs, gains.data(), volume, frames);
+  MixMatrix(inputs, outputs, gains).mix(input.data(), matrix.data(), volume, frames);
+  for (auto o = 0u; o < outputs; o++) {
+    for (auto i = 0u; i < frames; i++) {
+      error.add(kernel.channel(o)[i], expected.channel(o)[i]);
+      error.add(matrix.channel(o)[i], expected.channel(o)[i]);
+    }
+  }
+}
+
+bool testMixKernels()
+{
+  const unsigned int layouts[][2] = { { 1, 2 }, { 2, 2 }, { 1, 6 }, { 2, 6 }, { 6, 6 },
+                                      { 1, 8 }, { 2, 8 }, { 8, 8 }, { 3, 5 } };
+  ErrorMeter error;
+  for (auto& layout : layouts) {
+    auto inputs = layout[0], outputs = layout[1];
+    std::vector<float> gains(inputs * outputs);
+    fillNoise(gains.data(), gains.size(), inputs * outputs);
+
+    // a dense, a diagonal, a sparse and a silent pattern of the same layout.
+    compareMix(inputs, outputs, gains, error);
+    compareMix(inputs, outputs, defaultMatrix(inputs, outputs), error);
+    auto sparse = gains;
+    for (auto i = 0u; i < sparse.size(); i++)
+      if (i % 3 != 0) sparse[i] = 0.f;
+    compareMix(inputs, outputs, sparse, error);
+    compareMix(inputs, outputs, std::vector<float>(inputs * outputs, 0.f), error);
+  }
+  return report("mix kernels", error.relative(), 1e-6);
+}
+
+// ============================================================================
+// Test - Sharded Mixer
+// Renders the same graph of four groups of submix buses with the mixer and
+// with a mixer sharded by the groups. Both sum the groups in the same order
+// before the master compressor and limiter, so the outputs match exactly. The
+// deadline is disabled, as a late quantum would bypass some of the effects.
+// ============================================================================
+bool testShardedMixer()
+{
+  const auto rate = 48000u;
+  const auto frames = rate / 100;
+  const auto quanta = 100u;
+  const auto samples = std::make_shared<const PlanarBuffer>(noise(2, rate));
+
+  Mixer mixer(2, rate, frames, std::max(2u, std::thread::hardware_concurrency()));
+  ShardedMixer sharded(2, rate, frames, 4);
+  mixer.setDeadline(false);
+  sharded.setDeadline(false);
+  for (auto g = 0u; g < 4; g++) {
+    auto& shard = sharded.shard(g);
+    auto group = mixer.createSubmix(2, nullptr);
+    auto shardGroup = shard.createSubmix(2, nullptr);
+    for (auto b = 0; b < 4; b++) {
+      auto bus = mixer.createSubmix(2, group);
+      auto shardBus = shard.createSubmix(2, shardGroup);
+      for (auto effect : { MASTER_COMPRESSOR, MASTER_LIMITER }) {
+        mixer.addEffect(bus, std::make_unique<Dynamics>(effect));
+        shard.addEffect(shardBus, std::make_unique<Dynamics>(effect));
+      }
+      for (auto v = 0; v < 4; v++) {
+        for (auto voice : { mixer.createVoice(samples, bus), shard.createVoice(samples, shardBus) }) {
+          voice->volume = 0.1f * (v + b + g + 1);
+          voice->playing = true;
+        }
+      }
+    }
+  }
+  for (auto effect : { MASTER_COMPRESSOR, MASTER_LIMITER }) {
+    mixer.addEffect(mixer.master(), std::make_unique<Dynamics>(effect));
+    sharded.addEffect(std::make_unique<Dynamics>(effect));
+  }
+
+  ErrorMeter error;
+  std::vector<float> expected(frames * 2), output(frames * 2);
+  for (auto q = 0u; q < quanta; q++) {
+    mixer.render(expected.data(), frames);
+    sharded.render(output.data(), frames);
+    for (auto i = 0u; i < frames * 2; i++)
+      error.add(output[i], expected[i]);
+  }
+  return report("sharded mixer", error.relative(), 0.0);
+}
+
+// ============================================================================
+// Test - Wide Mixer
+// Renders a graph of more leaf buses than the scheduler queues used to hold,
+// all queued into the single worker of the mixer. Each bus plays a constant,
+// so the master bus is the sum of the constants.
+// ============================================================================
+bool testWideMixer()
+{
+  const auto rate = 48000u;
+  const auto frames = rate / 100;
+  const auto buses = 1000u;
+  auto samples = std::make_shared<PlanarBuffer>(2, frames);
+  for (auto c = 0u; c < 2; c++)
+    std::fill(samples->channel(c), samples->channel(c) + frames, 1.f / buses);
+
+  Mixer mixer(2, rate, frames, 1);
+  mixer.setDeadline(false);
+  for (auto b = 0u; b < buses; b++)
+    mixer.createVoice(samples, mixer.createSubmix(2, nullptr))->playing = true;
+
+  ErrorMeter error;
+  std::vector<float> output(frames * 2);
+  mixer.render(output.data(), frames);
+  for (auto sample : output)
+    error.add(sample, 1.0);
+  return report("wide mixer (1000 leaf buses)", error.relative(), 1e-4);
+}
+
+// ============================================================================
+// Test - Silence Skipping
+// Renders a noise burst into a bus with the room reverb and the limiter, once
+// with a voice that stops after the burst, so the effects are skipped once the
+// bus has been silent for their tails, and once with a voice that keeps playing
+// explicit zeros through them. The outputs may only differ by the skipped tail
+// (below -90dB), and the skipping bus must have gone silent by the end.
+// ============================================================================
+bool testSilenceSkipping()
+{
+  const auto rate = 48000u;
+  const auto frames = rate / 100;
+  const auto quanta = 400u;
+  const auto burst = rate / 10;
+  auto padded = std::make_shared<PlanarBuffer>(noise(2, frames * quanta, 3));
+  for (auto c = 0u; c < 2; c++)
+    std::fill(padded->channel(c) + burst, padded->channel(c) + frames * quanta, 0.f);
+  auto burstOnly = std::make_shared<PlanarBuffer>(2, burst);
+  for (auto c = 0u; c < 2; c++)
+    std::copy(padded->channel(c), padded->channel(c) + burst, burstOnly->channel(c));
+
+  Mixer skipping(2, rate, frames, 1), zeros(2, rate, frames, 1);
+  for (auto mixer : { &skipping, &zeros }) {
+    mixer->setDeadline(false);
+    auto bus = mixer->createSubmix(2, nullptr);
+    mixer->addEffect(bus, std::make_unique<FdnReverb<8>>(FDN_ROOM));
+    mixer->addEffect(bus, std::make_unique<Dynamics>(MASTER_LIMITER));
+    mixer->createVoice(mixer == &skipping ? burstOnly : padded, bus)->playing = true;
+  }
+
+  ErrorMeter error;
+  auto last = 0.f;
+  std::vector<float> expected(frames * 2), output(frames * 2);
+  for (auto q = 0u; q < quanta; q++) {
+    zeros.render(expected.data(), frames);
+    skipping.render(output.data(), frames);
+    for (auto i = 0u; i < frames * 2; i++)
+      error.add(output[i], expected[i]);
+    last = peakAbs(output.data(), output.size());
+  }
+  auto passed = report("silence skipping against explicit zeros", error.relative(), 3.2e-5);
+  return report("silence skipping went silent", last, 0.0) && passed;
+}
+
+// ============================================================================
+// Test - Shard Merge
+// Captures the output of a shard with the tap into a ring and plays the ring
+// with a simulated merge voice, which plays a queued block per pass. The shard
+// runs on a jittered clock which is late by a pass every now and then and
+// catches up in the next one. With the preroll, the merge voice has to play
+// all the captured samples in order without running dry, while the same clock
+// without the preroll leaves gaps (which checks that the clock is jittered).
+// ============================================================================
+struct MergeResult
+{
+  double       error;     // the played samples against the captured ones.
+  unsigned int underruns; // the passes where the voice ran dry after starting.
+  size_t       pending;   // the captured blocks which weren't played.
+};
+
+MergeResult mergeShard(size_t preroll)
+{
+  const auto rate = 48000u;
+  const auto frames = rate / 100;
+  const auto channels = 2u;
+  const unsigned int clock[] = { 1, 1, 0, 2, 1, 0, 2, 1, 1, 0, 2, 0, 2, 1 };
+  const auto clockLength = sizeof(clock) / sizeof(clock[0]);
+  const auto passes = 20 * clockLength;
+
+  SampleRing ring(frames * channels * sizeof(float) * 2, 8);
+  RingQueue queue(ring, preroll);
+  ShardTap tap(ring);
+  tap.prepare(channels, rate, frames);
+
+  auto input = noise(channels, frames * passes, 5);
+  std::vector<float> captured, played;
+  std::deque<SampleView> voice;
+  ErrorMeter error;
+  MergeResult result = {};
+  auto rendered = 0u;
+  for (auto pass = 0u; pass < passes; pass++) {
+    // the shard taps the passes of its clock, which get silenced.
+    for (auto tick = 0u; tick < clock[pass % clockLength]; tick++, rendered++) {
+      float* planes[2] = { input.channel(0) + rendered * frames, input.channel(1) + rendered * frames };
+      for (auto i = 0u; i < frames; i++)
+        for (auto c = 0u; c < channels; c++)
+          captured.push_back(planes[c][i]);
+      tap.process(planes, frames);
+      for (auto c = 0u; c < channels; c++)
+        for (auto i = 0u; i < frames; i++)
+          error.add(planes[c][i], 0.0);
+    }
+
+    // the merge voice queues the ready blocks and plays the oldest one.
+    queue.pump([&](SampleView view) { voice.push_back(view); });
+    if (voice.empty()) {
+      result.underruns += played.empty() ? 0 : 1;
+      continue;
+    }
+    auto block = reinterpret_cast<const float*>(voice.front().data);
+    played.insert(played.end(), block, block + voice.front().size / sizeof(float));
+    voice.pop_front();
+    queue.release();
+  }
+
+  for (auto i = 0u; i < played.size(); i++)
+    error.add(played[i], captured[i]);
+  result.error = error.relative();
+  result.pending = (captured.size() - played.size()) / (frames * channels);
+  return result;
+}
+
+bool testShardMerge()
+{
+  const auto preroll = 2u;
+  auto buffered = mergeShard(preroll);
+  auto unbuffered = mergeShard(0);
+  auto passed = report("shard merge", buffered.error, 0.0);
+  passed = report("shard merge underruns", buffered.underruns, 0.0) && passed;
+  passed = report("shard merge pending blocks", buffered.pending, preroll) && passed;
+  return report("shard merge underruns without preroll", unbuffered.underruns > 0 ? 0.0 : 1.0, 0.0) && passed;
+}
+
+// ============================================================================
+// Test - Slot Map
+// Checks the handles of the slot map against the dense indices they must find.
+// Each check counts a mismatch: a handle whose slot was freed and reused must
+// be stale, erasing moves the last element into the hole, and a map filled up
+// to its budget again after erasing everything reuses the same slots.
+// ============================================================================
+bool testSlotMap()
+{
+  auto mismatches = 0u;
+  auto check = [&](bool ok) { mismatches += ok ? 0 : 1; };
+
+  // a stale handle after its slot is erased and reused.
+  SlotMap map;
+  auto stale = map.insert();
+  map.erase(map.find(stale));
+  auto reused = map.insert();
+  check(reused.index == stale.index && reused.generation != stale.generation);
+  check(map.find(stale) == SLOT_INVALID);
+  check(map.find(reused) == 0);
+  map.erase(map.find(reused));
+
+  // erase from the middle and reinsert.
+  SoundHandle handles[3] = { map.insert(), map.insert(), map.insert() };
+  map.erase(map.find(handles[0]));
+  check(map.find(handles[0]) == SLOT_INVALID);
+  check(map.find(handles[2]) == 0 && map.find(handles[1]) == 1);
+  auto reinserted = map.insert();
+  check(reinserted.index == handles[0].index && map.find(reinserted) == 2);
+  check(map.size() == 3);
+
+  // fill up to the budget, erase everything and fill again.
+  const auto budget = 64u;
+  SlotMap full;
+  std::vector<SoundHandle> first, second;
+  for (auto i = 0u; i < budget; i++)
+    first.push_back(full.insert());
+  for (auto i = 0u; i < budget; i++)
+    full.erase(full.find(first[(i * 7) % budget]));
+  check(full.size() == 0);
+  for (auto i = 0u; i < budget; i++)
+    second.push_back(full.insert());
+  for (auto i = 0u; i < budget; i++) {
+    check(second[i].index < budget && full.find(second[i]) == i);
+    check(full.find(first[i]) == SLOT_INVALID);
+  }
+  return report("slot map mismatches", mismatches, 0.0);
+}
+
+// ============================================================================
+// Test - Sound Index
+// Builds the perfect hash over the IDs of a few hundred sound names, where each
+// ID must find its own index and the IDs outside the set must find nothing. An
+// ID given twice can't be told apart and must be rejected.
+// ============================================================================
+bool testSoundIndex()
+{
+  const auto count = 500u;
+  std::vector<uint32_t> ids;
+  for (auto i = 0u; i < count; i++)
+    ids.push_back(soundId((L"sfx/sound" + std::to_wstring(i) + L".wav").c_str()));
+  SoundIndex index;
+  index.build(ids);
+
+  auto mismatches = 0u;
+  for (auto i = 0u; i < count; i++)
+    mismatches += index.find(ids[i]) == i ? 0 : 1;
+  for (auto i = count; i < count * 2; i++) {
+    auto id = soundId((L"sfx/sound" + std::to_wstring(i) + L".wav").c_str());
+    mismatches += index.find(id) == SLOT_INVALID ? 0 : 1;
+  }
+  auto passed = report("sound index mismatches", mismatches, 0.0);
+
+  auto rejected = false;
+  try {
+    SoundIndex duplicates;
+    duplicates.build({ soundId(L"a.wav"), soundId(L"b.wav"), soundId(L"a.wav") });
+  } catch (const std::invalid_argument&) {
+    rejected = true;
+  }
+  return report("sound index duplicate rejected", rejected ? 0.0 : 1.0, 0.0) && passed;
+}
+
+// ============================================================================
+// Test - Meter Spectrum
+// Meters a sine centred on a bin of the transform. With the normalized Hann
+// window the bin reads the amplitude of the sine, the two neighbours read half
+// of it and all the other bins read nothing.
+// ============================================================================
+bool testMeterSpectrum()
+{
+  const auto pi = 3.14159265358979323846;
+  const auto rate = 48000u;
+  const auto quantum = rate / 100;
+  const auto fftSize = 1024u;
+  const auto bin = 64u;
+  const auto amplitude = 0.5;
+
+  PlanarBuffer signal(2, rate / 10);
+  for (auto c = 0u; c < 2; c++)
+    for (auto i = 0u; i < signal.frames(); i++)
+      signal.channel(c)[i] = float(amplitude * std::sin(2.0 * pi * bin * i / fftSize));
+  Meter meter(fftSize);
+  meter.prepare(2, rate, quantum);
+  for (auto done = 0u; done < signal.frames(); done += quantum) {
+    float* planes[2] = { signal.channel(0) + done, signal.channel(1) + done };
+    meter.process(planes, std::min(quantum, signal.frames() - done));
+  }
+
+  auto& reading = meter.read();
+  ErrorMeter error;
+  auto loudest = 0u;
+  for (auto k = 0u; k < reading.bins; k++) {
+    auto expected = k == bin ? amplitude : k + 1 == bin || k == bin + 1 ? amplitude / 2 : 0.0;
+    error.add(reading.spectrum[k], expected);
+    if (reading.spectrum[k] > reading.spectrum[loudest])
+      loudest = k;
+  }
+  auto passed = report("meter spectrum", reading.bins == fftSize / 2 ? error.relative() : 1.0, 1e-4);
+  return report("meter spectrum peak bin", std::abs(double(loudest) - bin), 0.0) && passed;
+}
+
+// ============================================================================
+// Test - Loudness
+// Measures a sine of a known level over a few seconds and over a prefix that
+// is shorter than a single gating block, which must measure the same.
+// ============================================================================
+bool testLoudness()
+{
+  const auto pi = 3.14159265358979323846;
+  const auto rate = 48000u;
+  auto measure = [&](unsigned int frames) {
+    PlanarBuffer planes(2, frames);
+    for (auto c = 0u; c < 2; c++)
+      for (auto i = 0u; i < frames; i++)
+        planes.channel(c)[i] = float(0.1 * std::sin(2.0 * pi * 1000.0 * i / rate));
+    return analyseLoudness(planes, rate).integrated;
+  };
+
+  // a 1kHz sine with a -20dBFS peak in both channels measures about -20 LUFS.
+  auto full = measure(5 * rate);
+  auto prefix = measure(3 * rate / 10);
+  auto passed = report("loudness", std::abs(full + 20.0), 0.1);
+  return report("loudness (300ms prefix)", std::abs(prefix - full), 0.1) && passed;
+}
+
+// ============================================================================
+// Test - Run
+// Runs all the portable tests. The sandbox runs these with the --test argument
+// and the offline build with the same argument (also registered with ctest).
+// ============================================================================
+int runTests()
+{
+  auto passed = true;
+  passed = testFft() && passed;
+  passed = testConvolution() && passed;
+  passed = testResample() && passed;
+  passed = testBiquadBank() && passed;
+  passed = testLimiter() && passed;
+  passed = testMixKernels() && passed;
+  passed = testShardedMixer() && passed;
+  passed = testWideMixer() && passed;
+  passed = testSilenceSkipping() && passed;
+  passed = testShardMerge() && passed;
+  passed = testSlotMap() && passed;
+  passed = testSoundIndex() && passed;
+  passed = testMeterSpectrum() && passed;
+  passed = testLoudness() && passed;
+  std::cout << (passed ? "all tests passed" : "some tests FAILED") << std::endl;
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,10 @@
+// ============================================================================
+// XAudio2 Sandbox - Tests
+// The tests check the portable DSP blocks and the mixer against plain reference
+// implementations, so the optimized kernels can be verified both within the
+// sandbox (--test) and with the offline build (e.g. with ctest).
+// ============================================================================
+#pragma once
+
+// run all the portable tests and print the results. returns 0 if all passed.
+int runTests();
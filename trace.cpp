@@ -0,0 +1,62 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+
+std::atomic<bool> traceEnabled;
+
+static TraceBuffer                           traceBuffers[TRACE_MAX_THREADS];
+static TraceBuffer                           traceNoBuffer = { nullptr, { TRACE_MAX_EVENTS } };
+static std::atomic<unsigned int>             traceBufferCount;
+static int64_t                               traceStart;
+static std::chrono::steady_clock::time_point traceStartTime;
+
+void startTracing()
+{
+  for (auto& buffer : traceBuffers)
+    buffer.events.reset(new TraceEvent[TRACE_MAX_EVENTS]());
+  traceStartTime = std::chrono::steady_clock::now();
+  traceStart = traceTimestamp();
+  traceEnabled = true;
+}
+
+// assign a trace buffer for the calling thread. The threads left without one
+// cache a sentinel buffer which reads as full, so they only touch the shared
+// counter once instead of on every event.
+TraceBuffer* assignTraceBuffer(TraceBuffer*& buffer)
+{
+  auto index = traceBufferCount.fetch_add(1);
+  buffer = index < TRACE_MAX_THREADS ? &traceBuffers[index] : &traceNoBuffer;
+  return buffer;
+}
+
+void writeTrace(const std::string& path)
+{
+  // calibrate the timestamp counter against the steady clock.
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - traceStartTime).count();
+  auto ticksPerMicrosecond = (traceTimestamp() - traceStart) / (elapsed * 1e6);
+  auto microseconds = [&](int64_t ticks) { return ticks / ticksPerMicrosecond; };
+
+  // write the complete ("X") events of each thread in the Chrome trace format,
+  // where the threads are identified by the index of their buffer.
+  std::ofstream file(path);
+  file << "{\"traceEvents\":[";
+  auto separator = "";
+  auto threads = std::min(traceBufferCount.load(), TRACE_MAX_THREADS);
+  for (auto t = 0u; t < threads; t++) {
+    auto& buffer = traceBuffers[t];
+    auto count = buffer.count.load(std::memory_order_acquire);
+    for (auto i = 0u; i < count; i++) {
+      auto& event = buffer.events[i];
+      file << separator
+           << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1"
+           << ",\"tid\":" << t + 1
+           << ",\"ts\":" << microseconds(event.begin - traceStart)
+           << ",\"dur\":" << microseconds(event.end - event.begin) << "}";
+      separator = ",";
+    }
+  }
+  file << "]}" << std::endl;
+}
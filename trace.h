@@ -0,0 +1,105 @@
+// ============================================================================
+// Trace - Timeline Events
+// Timeline tracing records scoped events (e.g. decoding or audio passes) with
+// the thread and the begin and end timestamps. Events are written by each
+// thread into its own preallocated buffer, so recording an event only takes
+// two timestamp counter reads and a single atomic store without any locking.
+// Timestamps are raw CPU timestamp counter values, which are converted into
+// microseconds with the steady clock only when the trace is written.
+//
+// The events are recorded inline and the buffers are touched up front, so the
+// cost of an event is little more than the two counter reads and depends on
+// the host: the offline benchmark measures about 52-55 ns per event in a
+// virtual machine where a single read takes 24-26 ns, which is over the 50 ns
+// budget of an event. The benchmark reports the cost of a read next to it.
+//
+// Tracing is enabled with startTracing, which allocates all the buffers up
+// front. While it's disabled, a scoped event costs a single atomic load. The
+// recorded events can be written at any time into a JSON file with writeTrace,
+// where the file can be opened with chrome://tracing or the Perfetto UI.
+//
+// Tracing doesn't depend on any Windows API, so the portable DSP blocks and
+// the mixer can record their events in the offline build too.
+// ============================================================================
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+const unsigned int TRACE_MAX_THREADS = 16;
+const unsigned int TRACE_MAX_EVENTS = 16384;
+
+extern std::atomic<bool> traceEnabled;
+
+inline int64_t traceTimestamp()
+{
+  return static_cast<int64_t>(__rdtsc());
+}
+
+struct TraceEvent
+{
+  const char* name;
+  int64_t     begin;
+  int64_t     end;
+};
+
+struct TraceBuffer
+{
+  std::unique_ptr<TraceEvent[]> events;
+  std::atomic<unsigned int>     count;
+};
+
+void startTracing();
+void writeTrace(const std::string& path);
+TraceBuffer* assignTraceBuffer(TraceBuffer*& buffer);
+
+// the trace buffer of the calling thread or null if all are in use. it's only
+// assigned on the first event of the thread, so the events are recorded inline
+// without calling into the trace unit.
+inline TraceBuffer* traceThreadBuffer()
+{
+  static thread_local TraceBuffer* buffer = nullptr;
+  return buffer ? buffer : assignTraceBuffer(buffer);
+}
+
+inline void traceEvent(const char* name, int64_t begin, int64_t end)
+{
+  auto buffer = traceThreadBuffer();
+
+  // events are dropped when the buffer of the thread gets full, and the threads
+  // left without a buffer get a buffer which is full from the start.
+  auto count = buffer->count.load(std::memory_order_relaxed);
+  if (count >= TRACE_MAX_EVENTS) return;
+  buffer->events[count] = { name, begin, end };
+  buffer->count.store(count + 1, std::memory_order_release);
+}
+
+class TraceScope
+{
+public:
+  explicit TraceScope(const char* name)
+    : name(name), begin(traceEnabled.load(std::memory_order_relaxed) ? traceTimestamp() : 0)
+  {
+  }
+
+  ~TraceScope()
+  {
+    if (begin != 0)
+      traceEvent(name, begin, traceTimestamp());
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  const char* name;
+  int64_t     begin;
+};